@@ -1,48 +1,97 @@
+#pragma once
+
+#include "parallelTreap.h"
 #include "treap.h"
-#include <vector>
+#include "versionHeap.h"
+
+// Операции дерева для BasicVersionHeap
+template <typename Node>
+struct TreapOps {
+   using Handle = PoolHandle<Node>;
+   using Version = BasicTreapVersion<Node>;
+   using Transient = BasicTreapTransient<Node>;
+   using value_type = typename Node::value_type;
+   using aggregate_type = typename Node::aggregate_type;
+   using tag_type = typename Node::tag_type;
+
+   static Handle Build(const std::vector<value_type>& values) {
+      return ::ParallelBuild<Node>(values);
+   }
+
+   static Handle Insert(Handle root, int index, const value_type& x) {
+      return ::Insert(root, index, x);
+   }
 
-class PTHeap {
-public:
-   PTHeap() = default;
+   static Handle InsertRange(Handle root, int index, const value_type* values, int count) {
+      return ::InsertRange(root, index, values, count);
+   }
 
-   PTHeap(PersistentTreap* first) {
-      heap.push_back(first);
+   static Handle Remove(Handle root, int index) {
+      return ::Remove(root, index);
    }
 
-   void InsertToTreap(int index, int val) {
-      heap.push_back(Insert(heap.back(), index, val));
+   static Handle RangeAdd(Handle root, int l, int r, const tag_type& delta) {
+      return ::RangeAdd(root, l, r, delta);
    }
 
-   void RemoveFromTreap(int index) {
-      heap.push_back(Remove(heap.back(), index));
+   static Handle Concat(const std::vector<Handle>& parts) {
+      return ::Concat(parts);
    }
 
-   long long GetSumFromTreap(int l, int r) {
-      return GetSum(heap.back(), l, r);
+   static std::vector<Handle> SplitMany(Handle root, const std::vector<int>& cuts) {
+      return ::SplitMany(root, cuts);
    }
 
-   std::ostream& PrintTreapSegment(std::ostream& out, int l, int r) {
-      PrintSegment(out, heap.back(), l, r);
+   // ops отсортированы по индексу
+   static Handle ApplyBatch(Handle root, const BatchOp<value_type>* ops, int count) {
+      return ::ApplyBatch(root, ops, count);
+   }
+
+   static void AddRef(Handle root) {
+      addLink(root);
+   }
 
-      return out;
+   static void Release(Handle root) {
+      DelNode(root);
    }
 
-   long long GetSize() {
-       return getSize(heap.back());
+   // Обход для подсчёта памяти (BasicVersionHeap::GetMemoryStats)
+   static std::uint64_t NodeKey(Handle node) {
+      return node.id;
    }
 
-   void CancelOperations(int count) {
-      for (int i = 0; i < count; ++i) {
-         heap.back()->Del();
-         heap.pop_back();
+   static size_t NodeBytes(Handle) {
+      return sizeof(Node);
+   }
+
+   template <typename Func>
+   static void ForEachChild(Handle node, Func&& visit) {
+      if (node->left) {
+         visit(node->left);
+      }
+      if (node->right) {
+         visit(node->right);
       }
    }
 
-private:
-   std::vector<PersistentTreap*> heap;
+   static size_t LiveNodes() {
+      return NodePool<Node>::Instance().LiveNodes();
+   }
 
+   static size_t LiveBytes() {
+      return LiveNodes() * sizeof(Node);
+   }
+
+   static size_t BytesReserved() {
+      return NodePool<Node>::Instance().BytesReserved();
+   }
 };
 
+template <typename Node>
+using BasicPTHeap = BasicVersionHeap<TreapOps<Node>>;
+
+using PTHeap = BasicPTHeap<PersistentTreap>;
+
 #ifndef TREAP_PERSISTENTTREAPHEAP_H
 #define TREAP_PERSISTENTTREAPHEAP_H
 
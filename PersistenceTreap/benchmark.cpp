@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "PersistentTreapHeap.h"
+#include "persistentRope.h"
+#include "profiler.h"
+
+using namespace std;
+
+/*
+ * Замер ops/sec для insert, remove, range sum, range add и undo на разных размерах
+ * и глубинах истории. Персистентные кучи (PTHeap, RopeHeap) сравниваются с std::vector
+ * и неперсистентным декартовым деревом (TreapTransient, меняется на месте).
+ * У неперсистентных структур undo - обратная операция из журнала.
+ *
+ * TreapBench [--quick] [--ops N] [--sizes a,b,c] [--depths a,b,c] [--json file]
+ */
+
+struct BenchConfig {
+   vector<int> sizes{10000, 100000, 1000000};
+   vector<int> depths{0, 1000, 100000};
+   int ops = 20000;
+   double budget_sec = 1.0;
+   string json_path;
+};
+
+struct BenchResult {
+   string structure;
+   int size;
+   int history;
+   string op;
+   long long ops;
+   double seconds;
+};
+
+struct MemoryResult {
+   string structure;
+   int size;
+   int history;
+   MemoryStats stats;
+};
+
+// Журнал для undo у неперсистентных структур
+struct UndoRecord {
+   enum Kind { Insert, Remove, RangeAdd };
+
+   Kind kind;
+   int index;
+   int r;
+   long long value;
+};
+
+class VectorSubject {
+public:
+   static constexpr const char* kName = "vector";
+   static constexpr bool kPersistent = false;
+
+   explicit VectorSubject(const vector<long long>& values)
+      : a(values)
+   {}
+
+   void Insert(int index, long long x) {
+      a.insert(a.begin() + index, x);
+      log.push_back({UndoRecord::Insert, index, 0, 0});
+   }
+
+   void Remove(int index) {
+      log.push_back({UndoRecord::Remove, index, 0, a[index]});
+      a.erase(a.begin() + index);
+   }
+
+   long long Sum(int l, int r) const {
+      return accumulate(a.begin() + l, a.begin() + r + 1, 0LL);
+   }
+
+   void RangeAdd(int l, int r, long long delta) {
+      for (int i = l; i <= r; ++i) {
+         a[i] += delta;
+      }
+      log.push_back({UndoRecord::RangeAdd, l, r, delta});
+   }
+
+   void Undo() {
+      UndoRecord rec = log.back();
+      log.pop_back();
+      if (rec.kind == UndoRecord::Insert) {
+         a.erase(a.begin() + rec.index);
+      } else if (rec.kind == UndoRecord::Remove) {
+         a.insert(a.begin() + rec.index, rec.value);
+      } else {
+         for (int i = rec.index; i <= rec.r; ++i) {
+            a[i] -= rec.value;
+         }
+      }
+   }
+
+   int Size() const {
+      return a.size();
+   }
+
+private:
+   vector<long long> a;
+   vector<UndoRecord> log;
+};
+
+class TreapSubject {
+public:
+   static constexpr const char* kName = "treap";
+   static constexpr bool kPersistent = false;
+
+   explicit TreapSubject(const vector<long long>& values)
+      : t(TreapVersion::Adopt(Build<PersistentTreap>(values)))
+   {}
+
+   void Insert(int index, long long x) {
+      t.Insert(index, x);
+      log.push_back({UndoRecord::Insert, index, 0, 0});
+   }
+
+   void Remove(int index) {
+      log.push_back({UndoRecord::Remove, index, 0, t.Get(index)});
+      t.Remove(index);
+   }
+
+   long long Sum(int l, int r) const {
+      return t.GetSum(l, r);
+   }
+
+   void RangeAdd(int l, int r, long long delta) {
+      t.RangeAdd(l, r, delta);
+      log.push_back({UndoRecord::RangeAdd, l, r, delta});
+   }
+
+   void Undo() {
+      UndoRecord rec = log.back();
+      log.pop_back();
+      if (rec.kind == UndoRecord::Insert) {
+         t.Remove(rec.index);
+      } else if (rec.kind == UndoRecord::Remove) {
+         t.Insert(rec.index, rec.value);
+      } else {
+         t.RangeAdd(rec.index, rec.r, -rec.value);
+      }
+   }
+
+   int Size() const {
+      return t.Size();
+   }
+
+private:
+   TreapTransient t;
+   vector<UndoRecord> log;
+};
+
+// Любая куча с интерфейсом BasicVersionHeap: каждая операция - новая версия, undo - CancelOperations
+template <typename Heap>
+class HeapSubject {
+public:
+   static constexpr bool kPersistent = true;
+
+   explicit HeapSubject(const vector<long long>& values)
+      : heap(values)
+      , size(values.size())
+   {}
+
+   void Insert(int index, long long x) {
+      heap.InsertToTreap(index, x);
+      ++size;
+   }
+
+   void Remove(int index) {
+      heap.RemoveFromTreap(index);
+      --size;
+   }
+
+   long long Sum(int l, int r) const {
+      return heap.GetSumFromTreap(l, r);
+   }
+
+   void RangeAdd(int l, int r, long long delta) {
+      heap.RangeAddToTreap(l, r, delta);
+   }
+
+   void Undo() {
+      heap.CancelOperations(1);
+      size = heap.GetSize();
+   }
+
+   int Size() const {
+      return size;
+   }
+
+   MemoryStats Memory() const {
+      return heap.GetMemoryStats();
+   }
+
+private:
+   Heap heap;
+   int size;
+};
+
+struct PTHeapSubject : HeapSubject<PTHeap> {
+   static constexpr const char* kName = "PTHeap";
+   using HeapSubject::HeapSubject;
+};
+
+struct RopeHeapSubject : HeapSubject<RopeHeap> {
+   static constexpr const char* kName = "RopeHeap";
+   using HeapSubject::HeapSubject;
+};
+
+vector<long long> RandomValues(mt19937_64& gen, int size) {
+   vector<long long> values(size);
+   for (auto& value : values) {
+      value = gen() % 1000;
+   }
+   return values;
+}
+
+pair<int, int> RandomSegment(mt19937_64& gen, int size) {
+   int l = gen() % size;
+   int r = gen() % size;
+   if (l > r) {
+      swap(l, r);
+   }
+   return {l, r};
+}
+
+// Повторяет step до limit раз или пока не выйдет бюджет времени
+template <typename Step>
+BenchResult Measure(const BenchConfig& config, const string& structure, int size, int history,
+                    const string& op, long long limit, Step&& step) {
+   long long done = 0;
+   uint64_t start = NSProfiler::NowNs();
+   uint64_t deadline = start + static_cast<uint64_t>(config.budget_sec * 1e9);
+   while (done < limit) {
+      step();
+      ++done;
+      if ((done & 63) == 0 && NSProfiler::NowNs() > deadline) {
+         break;
+      }
+   }
+   double seconds = (NSProfiler::NowNs() - start) / 1e9;
+   return BenchResult{structure, size, history, op, done, seconds};
+}
+
+template <typename Subject>
+void RunSubject(const BenchConfig& config, int size, int history, vector<BenchResult>& results,
+                vector<MemoryResult>& memory) {
+   mt19937_64 gen(size * 31 + history);
+   Subject subject(RandomValues(gen, size));
+
+   // История: смесь вставок, удалений и прибавок на отрезке перед замером
+   for (int i = 0; i < history; ++i) {
+      int n = subject.Size();
+      if (i % 3 == 0 || n < 2) {
+         subject.Insert(gen() % (n + 1), gen() % 1000);
+      } else if (i % 3 == 1) {
+         subject.Remove(gen() % n);
+      } else {
+         auto seg = RandomSegment(gen, n);
+         subject.RangeAdd(seg.first, seg.second, 1);
+      }
+   }
+
+   auto run = [&](const string& op, long long limit, auto&& step) {
+      results.push_back(Measure(config, Subject::kName, size, history, op, limit, step));
+      return results.back().ops;
+   };
+
+   long long inserted = run("insert", config.ops, [&] {
+      subject.Insert(gen() % (subject.Size() + 1), gen() % 1000);
+   });
+
+   // Отменяет только что сделанные вставки
+   run("undo", inserted, [&] {
+      subject.Undo();
+   });
+
+   // Удаляем не больше половины, чтобы отрезки дальше не вырождались
+   run("remove", min<long long>(config.ops, subject.Size() / 2), [&] {
+      subject.Remove(gen() % subject.Size());
+   });
+
+   volatile long long checksum = 0;
+   run("range_sum", config.ops, [&] {
+      auto seg = RandomSegment(gen, subject.Size());
+      checksum = checksum + subject.Sum(seg.first, seg.second);
+   });
+
+   run("range_add", config.ops, [&] {
+      auto seg = RandomSegment(gen, subject.Size());
+      subject.RangeAdd(seg.first, seg.second, 1);
+   });
+
+   if constexpr (Subject::kPersistent) {
+      memory.push_back(MemoryResult{Subject::kName, size, history, subject.Memory()});
+   }
+}
+
+vector<int> ParseList(const string& str) {
+   vector<int> res;
+   stringstream in(str);
+   string item;
+   while (getline(in, item, ',')) {
+      res.push_back(stoi(item));
+   }
+   return res;
+}
+
+void PrintTable(ostream& out, const vector<BenchResult>& results, const vector<MemoryResult>& memory) {
+   out << left << setw(10) << "structure" << setw(10) << "size" << setw(10) << "history"
+       << setw(12) << "op" << right << setw(10) << "ops" << setw(16) << "ops/sec" << "\n";
+   for (auto& res : results) {
+      out << left << setw(10) << res.structure << setw(10) << res.size << setw(10) << res.history
+          << setw(12) << res.op << right << setw(10) << res.ops
+          << setw(16) << fixed << setprecision(0) << res.ops / res.seconds << "\n";
+   }
+
+   out << "\n" << left << setw(10) << "structure" << setw(10) << "size" << setw(10) << "history"
+       << right << setw(10) << "versions" << setw(12) << "live_nodes" << setw(14) << "reachable_MB"
+       << setw(12) << "shared_MB" << setw(14) << "reserved_MB" << "\n";
+   for (auto& mem : memory) {
+      out << left << setw(10) << mem.structure << setw(10) << mem.size << setw(10) << mem.history
+          << right << setw(10) << mem.stats.versions << setw(12) << mem.stats.live_nodes
+          << setw(14) << setprecision(2) << mem.stats.reachable_bytes / 1e6
+          << setw(12) << mem.stats.shared_bytes / 1e6
+          << setw(14) << mem.stats.reserved_bytes / 1e6 << "\n";
+   }
+}
+
+void WriteJson(ostream& out, const vector<BenchResult>& results, const vector<MemoryResult>& memory) {
+   out << "{\"results\":[";
+   for (size_t i = 0; i < results.size(); ++i) {
+      auto& res = results[i];
+      out << (i ? "," : "") << "\n{\"structure\":\"" << res.structure << "\",\"size\":" << res.size
+          << ",\"history\":" << res.history << ",\"op\":\"" << res.op << "\",\"ops\":" << res.ops
+          << ",\"seconds\":" << res.seconds << ",\"ops_per_sec\":" << res.ops / res.seconds << "}";
+   }
+   out << "],\n\"memory\":[";
+   for (size_t i = 0; i < memory.size(); ++i) {
+      auto& mem = memory[i];
+      out << (i ? "," : "") << "\n{\"structure\":\"" << mem.structure << "\",\"size\":" << mem.size
+          << ",\"history\":" << mem.history << ",\"stats\":";
+      mem.stats.WriteJson(out);
+      out << "}";
+   }
+   out << "]}\n";
+}
+
+int main(int argc, char** argv) {
+   BenchConfig config;
+   for (int i = 1; i < argc; ++i) {
+      string arg = argv[i];
+      if (arg == "--quick") {
+         config.sizes = {1000, 100000};
+         config.depths = {0, 1000};
+         config.ops = 2000;
+         config.budget_sec = 0.2;
+      } else if (arg == "--ops" && i + 1 < argc) {
+         config.ops = stoi(argv[++i]);
+      } else if (arg == "--sizes" && i + 1 < argc) {
+         config.sizes = ParseList(argv[++i]);
+      } else if (arg == "--depths" && i + 1 < argc) {
+         config.depths = ParseList(argv[++i]);
+      } else if (arg == "--json" && i + 1 < argc) {
+         config.json_path = argv[++i];
+      } else {
+         cerr << "usage: " << argv[0] << " [--quick] [--ops N] [--sizes a,b,c] [--depths a,b,c] [--json file]\n";
+         return 1;
+      }
+   }
+
+   // Случайные индексы берутся по модулю размера, поэтому пустые последовательности не меряем
+   bool valid = config.ops >= 1 && !config.sizes.empty();
+   for (int size : config.sizes) {
+      valid = valid && size >= 1;
+   }
+   for (int history : config.depths) {
+      valid = valid && history >= 0;
+   }
+   if (!valid) {
+      cerr << "--ops and --sizes must be >= 1, --depths must be >= 0\n";
+      return 1;
+   }
+
+   vector<BenchResult> results;
+   vector<MemoryResult> memory;
+   for (int size : config.sizes) {
+      // У неперсистентных структур история не хранится, их меряем один раз на размер
+      RunSubject<VectorSubject>(config, size, 0, results, memory);
+      RunSubject<TreapSubject>(config, size, 0, results, memory);
+      for (int history : config.depths) {
+         RunSubject<PTHeapSubject>(config, size, history, results, memory);
+         RunSubject<RopeHeapSubject>(config, size, history, results, memory);
+      }
+   }
+
+   PrintTable(cout, results, memory);
+
+   if (!config.json_path.empty()) {
+      ofstream out(config.json_path);
+      if (!out) {
+         cerr << "cannot open " << config.json_path << "\n";
+         return 1;
+      }
+      WriteJson(out, results, memory);
+   }
+
+   return 0;
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * Пул fork-join с кражей работы. У каждого участника своя дека задач:
+ * хозяин кладёт и забирает задачи с конца, свободные потоки крадут с начала (самые крупные).
+ * Run(func) выполняет func в вызывающем потоке как участнике пула; внутри неё Invoke(f, g)
+ * выполняет f и g, возможно параллельно, и возвращается, когда обе закончены.
+ * Вне Run (и в потоках, не принадлежащих пулу) Invoke просто выполняет f, затем g.
+ * Задачи живут на стеке вызвавшего Invoke, поэтому кучи задач нет.
+ */
+class ForkJoinPool {
+public:
+   static ForkJoinPool& Instance() {
+      static ForkJoinPool pool(std::max(1u, std::thread::hardware_concurrency()));
+      return pool;
+   }
+
+   explicit ForkJoinPool(unsigned thread_count)
+      : slots(thread_count)
+   {
+      for (unsigned i = 1; i < thread_count; ++i) {
+         workers.emplace_back([this, i]() { WorkerLoop(i); });
+      }
+   }
+
+   ForkJoinPool(const ForkJoinPool&) = delete;
+   ForkJoinPool& operator=(const ForkJoinPool&) = delete;
+
+   ~ForkJoinPool() {
+      {
+         std::lock_guard<std::mutex> locker(sleep_m_);
+         stop = true;
+      }
+      wake.notify_all();
+      for (auto& worker : workers) {
+         worker.join();
+      }
+   }
+
+   unsigned ThreadCount() const {
+      return slots.size();
+   }
+
+   // Вызывающий поток занимает слот 0; одновременные Run из разных потоков идут по очереди
+   template <typename Func>
+   void Run(Func&& func) {
+      if (Current() == this) {
+         func();
+         return;
+      }
+
+      std::lock_guard<std::mutex> locker(run_m_);
+      Participant participant(this, 0);
+      func();
+   }
+
+   template <typename F, typename G>
+   void Invoke(F&& f, G&& g) {
+      if (Current() != this || slots.size() == 1) {
+         f();
+         g();
+         return;
+      }
+
+      Task task(g);
+      Push(&task);
+
+      std::exception_ptr error;
+      try {
+         f();
+      } catch (...) {
+         error = std::current_exception();
+      }
+
+      // Задачу не украли - выполняем сами, иначе помогаем другим, пока вор не закончит
+      if (PopIfLast(&task)) {
+         task.Execute();
+      } else {
+         while (!task.done.load(std::memory_order_acquire)) {
+            if (!RunOne()) {
+               std::this_thread::yield();
+            }
+         }
+      }
+
+      if (error) {
+         std::rethrow_exception(error);
+      }
+      if (task.error) {
+         std::rethrow_exception(task.error);
+      }
+   }
+
+private:
+   struct Task {
+      template <typename Func>
+      explicit Task(Func& func)
+         : body(const_cast<void*>(static_cast<const void*>(std::addressof(func))))
+         , call([](void* body) { (*static_cast<Func*>(body))(); })
+      {}
+
+      void Execute() {
+         try {
+            call(body);
+         } catch (...) {
+            error = std::current_exception();
+         }
+         done.store(true, std::memory_order_release);
+      }
+
+      void* body;
+      void (*call)(void*);
+      std::exception_ptr error;
+      std::atomic<bool> done{false};
+   };
+
+   struct Slot {
+      std::mutex m_;
+      std::deque<Task*> tasks;
+   };
+
+   // Делает поток участником пула на время жизни объекта
+   struct Participant {
+      Participant(ForkJoinPool* pool, unsigned index) {
+         CurrentRef() = pool;
+         IndexRef() = index;
+      }
+
+      ~Participant() {
+         CurrentRef() = nullptr;
+      }
+   };
+
+   std::vector<Slot> slots;
+   std::vector<std::thread> workers;
+   std::atomic<size_t> queued{0};
+
+   std::mutex run_m_;
+   std::mutex sleep_m_;
+   std::condition_variable wake;
+   bool stop = false;
+
+   static ForkJoinPool*& CurrentRef() {
+      thread_local ForkJoinPool* pool = nullptr;
+      return pool;
+   }
+
+   static unsigned& IndexRef() {
+      thread_local unsigned index = 0;
+      return index;
+   }
+
+   static ForkJoinPool* Current() {
+      return CurrentRef();
+   }
+
+   void Push(Task* task) {
+      Slot& slot = slots[IndexRef()];
+      {
+         std::lock_guard<std::mutex> locker(slot.m_);
+         slot.tasks.push_back(task);
+      }
+      queued.fetch_add(1, std::memory_order_release);
+      // Пустой захват: поток, проверивший queued до увеличения, уже спит и услышит notify
+      { std::lock_guard<std::mutex> locker(sleep_m_); }
+      wake.notify_one();
+   }
+
+   bool PopIfLast(Task* task) {
+      Slot& slot = slots[IndexRef()];
+      std::lock_guard<std::mutex> locker(slot.m_);
+      if (slot.tasks.empty() || slot.tasks.back() != task) {
+         return false;
+      }
+      slot.tasks.pop_back();
+      queued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+   }
+
+   // Своя дека с конца, затем кража с начала чужих
+   bool RunOne() {
+      unsigned self = IndexRef();
+      Task* task = nullptr;
+      for (unsigned i = 0; i < slots.size() && !task; ++i) {
+         Slot& slot = slots[(self + i) % slots.size()];
+         std::lock_guard<std::mutex> locker(slot.m_);
+         if (slot.tasks.empty()) {
+            continue;
+         }
+         if (i == 0) {
+            task = slot.tasks.back();
+            slot.tasks.pop_back();
+         } else {
+            task = slot.tasks.front();
+            slot.tasks.pop_front();
+         }
+      }
+      if (!task) {
+         return false;
+      }
+
+      queued.fetch_sub(1, std::memory_order_relaxed);
+      task->Execute();
+      return true;
+   }
+
+   void WorkerLoop(unsigned index) {
+      Participant participant(this, index);
+      while (true) {
+         if (RunOne()) {
+            continue;
+         }
+
+         std::unique_lock<std::mutex> locker(sleep_m_);
+         wake.wait(locker, [this]() { return stop || queued.load(std::memory_order_acquire) > 0; });
+         if (stop) {
+            return;
+         }
+      }
+   }
+};
+
+#ifndef TREAP_FORKJOIN_H
+#define TREAP_FORKJOIN_H
+
+#endif //TREAP_FORKJOIN_H
@@ -0,0 +1,247 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "PersistentTreapHeap.h"
+#include "persistentRope.h"
+#include "treapSnapshot.h"
+#include "log_duration.h"
+
+using namespace std;
+
+// Случайные операции над кучей и над vector, после каждой сверяются сумма и размер
+template <typename Heap>
+bool CheckAgainstVector(int size, int ops) {
+   mt19937_64 gen(size + ops);
+   vector<long long> model(size);
+   for (auto& x : model) {
+      x = gen() % 1000;
+   }
+   Heap heap(model);
+
+   for (int i = 0; i < ops; ++i) {
+      int kind = gen() % 3;
+      if (kind == 0 || model.size() < 2) {
+         int index = gen() % (model.size() + 1);
+         long long x = gen() % 1000;
+         heap.InsertToTreap(index, x);
+         model.insert(model.begin() + index, x);
+      } else if (kind == 1) {
+         int index = gen() % model.size();
+         heap.RemoveFromTreap(index);
+         model.erase(model.begin() + index);
+      } else {
+         int l = gen() % model.size();
+         int r = l + gen() % (model.size() - l);
+         heap.RangeAddToTreap(l, r, 1);
+         for (int j = l; j <= r; ++j) {
+            model[j] += 1;
+         }
+      }
+
+      int l = gen() % model.size();
+      int r = l + gen() % (model.size() - l);
+      long long expected = 0;
+      for (int j = l; j <= r; ++j) {
+         expected += model[j];
+      }
+      if (heap.GetSize() != static_cast<long long>(model.size()) || heap.GetSumFromTreap(l, r) != expected) {
+         cout << "mismatch after operation " << i << endl;
+         return false;
+      }
+   }
+   return true;
+}
+
+// Индексы за концом последовательности: удаление ничего не делает, вставка дописывает в конец
+template <typename Heap>
+bool CheckOutOfRange() {
+   using Op = typename Heap::Op;
+
+   Heap one(vector<long long>{7});
+   one.ApplyBatch({Op::MakeRemove(5)});
+   if (one.GetSize() != 1 || one.GetFromTreap(0) != 7) {
+      return false;
+   }
+
+   // Индексы пакета - в исходной версии: повторное удаление того же индекса удаляет элемент один раз
+   Heap base(vector<long long>{0, 1, 2, 3, 4});
+   base.ApplyBatch({Op::MakeRemove(1), Op::MakeRemove(1)});
+   if (base.GetSize() != 4 || base.GetFromTreap(1) != 2 || base.GetSumFromTreap(0, 3) != 9) {
+      return false;
+   }
+
+   Heap empty;
+   empty.ApplyBatch({Op::MakeRemove(0), Op::MakeRemove(5)});
+   if (empty.GetSize() != 0) {
+      return false;
+   }
+
+   empty.RemoveFromTreap(0);
+   empty.ApplyBatch({Op::MakeInsert(3, 1), Op::MakeRemove(4)});
+   empty.InsertToTreap(5, 2);
+   empty.InsertRangeToTreap(-1, {3, 4});
+   empty.RemoveFromTreap(4);
+   return empty.GetSize() == 4 && empty.GetFromTreap(0) == 3 && empty.GetFromTreap(3) == 2
+          && empty.GetFromTreap(4) == 0 && empty.GetSumFromTreap(0, 10) == 10;
+}
+
+template <typename Heap>
+void PrintMemory(const Heap& heap) {
+   MemoryStats stats = heap.GetMemoryStats();
+   cout << "versions: " << stats.versions << ", live nodes: " << stats.live_nodes
+        << ", reachable: " << stats.reachable_bytes << " bytes, shared: " << stats.shared_bytes << " bytes" << endl;
+}
+
+int main() {
+   while (true) {
+      cout << "Input test number:\n 1 - versions demo;\n 2 - correctness test (size - 1e3, operations - 1e4);\n "
+              "3 - memory test (size - 1e6, versions - 1e4);\n 4 - snapshot test (size - 1e6, versions - 1e4);\n "
+              "5 - parallel build/concat/split test (size - 1e7);\n 6 - out-of-range operations test;\n 0 - exit;" << endl;
+      int x;
+      cin >> x;
+
+      if (x == 1) {
+         PTHeap heap(vector<long long>{1, 2, 3, 4, 5});
+         VersionId base = heap.CurrentVersion();
+         heap.InsertToTreap(2, 10);
+         heap.RangeAddToTreap(0, 2, 100);
+         VersionId branch = heap.RemoveFromVersion(base, 0);
+
+         cout << "head: ";
+         heap.PrintTreapSegment(cout, 0, heap.GetSize() - 1) << endl;
+         cout << "branch: ";
+         heap.GetVersion(branch).PrintSegment(cout, 0, heap.GetVersion(branch).Size() - 1) << endl;
+
+         heap.CancelOperations(1);
+         cout << "after undo: ";
+         heap.PrintTreapSegment(cout, 0, heap.GetSize() - 1) << endl;
+         PrintMemory(heap);
+      } else if (x == 2) {
+         {
+            LOG_DURATION("PTHeap correctness")
+            cout << "PTHeap: " << (CheckAgainstVector<PTHeap>(1000, 10000) ? "ok" : "failed") << endl;
+         }
+         {
+            LOG_DURATION("RopeHeap correctness")
+            cout << "RopeHeap: " << (CheckAgainstVector<RopeHeap>(1000, 10000) ? "ok" : "failed") << endl;
+         }
+      } else if (x == 3) {
+         mt19937_64 gen(1);
+         vector<long long> values(1000000);
+         for (auto& value : values) {
+            value = gen() % 1000;
+         }
+
+         PTHeap treap(values);
+         RopeHeap rope(values);
+         {
+            LOG_DURATION("1e4 versions")
+            for (int i = 0; i < 10000; ++i) {
+               int index = gen() % values.size();
+               treap.InsertToTreap(index, i);
+               rope.InsertToTreap(index, i);
+            }
+         }
+         cout << "PTHeap: ";
+         PrintMemory(treap);
+         cout << "RopeHeap: ";
+         PrintMemory(rope);
+      } else if (x == 4) {
+         mt19937_64 gen(1);
+         vector<long long> values(1000000);
+         for (auto& value : values) {
+            value = gen() % 1000;
+         }
+
+         PTHeap heap(values);
+         for (int i = 0; i < 10000; ++i) {
+            heap.InsertToTreap(gen() % heap.GetSize(), i);
+         }
+         // Снимок в десятки мегабайт - во временный каталог, после проверки удаляется
+         string path = (filesystem::temp_directory_path() / "treap_snapshot.bin").string();
+         {
+            LOG_DURATION("write snapshot")
+            SaveSnapshot(path, heap);
+         }
+
+         PTHeap loaded;
+         {
+            LOG_DURATION("load snapshot")
+            LoadSnapshot(path, loaded);
+         }
+         bool same = true;
+         {
+            MappedSnapshot<PersistentTreap> mapped(path);
+            cout << "nodes in file: " << mapped.NodeCount() << ", versions: " << mapped.VersionCount() << endl;
+
+            for (VersionId id = 0; id <= heap.CurrentVersion(); id += 1000) {
+               int size = heap.GetVersion(id).Size();
+               long long expected = heap.GetVersion(id).GetSum(0, size - 1);
+               same = same && loaded.GetVersion(id).GetSum(0, size - 1) == expected
+                      && mapped.GetVersion(id).GetSum(0, size - 1) == expected;
+            }
+         }
+         remove(path.c_str());
+         cout << (same ? "snapshot ok" : "snapshot differs") << endl;
+      } else if (x == 5) {
+         vector<long long> values(10000000);
+         iota(values.begin(), values.end(), 0);
+         cout << "threads: " << ForkJoinPool::Instance().ThreadCount() << endl;
+
+         TreapPtr sequential;
+         {
+            LOG_DURATION("Build")
+            sequential = Build<PersistentTreap>(values);
+         }
+         TreapPtr parallel;
+         {
+            LOG_DURATION("ParallelBuild")
+            parallel = ParallelBuild<PersistentTreap>(values);
+         }
+
+         vector<int> cuts;
+         for (int i = 1; i < 64; ++i) {
+            cuts.push_back(values.size() / 64 * i);
+         }
+         vector<TreapPtr> pieces;
+         {
+            LOG_DURATION("SplitMany into 64 pieces")
+            pieces = SplitMany(parallel, cuts);
+         }
+         reverse(pieces.begin(), pieces.end());
+         TreapPtr joined;
+         {
+            LOG_DURATION("Concat of 64 pieces")
+            joined = Concat(pieces);
+         }
+         cout << "sum: " << GetSum(joined, 0, getSize(joined) - 1)
+              << ", expected: " << GetSum(sequential, 0, getSize(sequential) - 1) << endl;
+
+         for (auto piece : pieces) {
+            DelNode(piece);
+         }
+         DelNode(joined);
+         DelNode(parallel);
+         DelNode(sequential);
+      } else if (x == 6) {
+         cout << "PTHeap: " << (CheckOutOfRange<PTHeap>() ? "ok" : "failed") << endl;
+         cout << "RopeHeap: " << (CheckOutOfRange<RopeHeap>() ? "ok" : "failed") << endl;
+      } else if (x == 0) {
+         break;
+      }
+   }
+
+#ifdef DS_PROFILING
+   std::ofstream trace("trace.json");
+   NSProfiler::Profiler::Instance().WriteChromeTrace(trace);
+   NSProfiler::Profiler::Instance().WriteSummaryJson(std::cout);
+#endif
+
+   return 0;
+}
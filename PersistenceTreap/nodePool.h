@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+template <typename Node>
+class NodePool;
+
+/*!
+ * 32-битная ссылка на вершину в NodePool, 0 - пустая ссылка.
+ * Ведёт себя как указатель: ->, сравнение с nullptr.
+ */
+template <typename Node>
+struct PoolHandle {
+   PoolHandle() = default;
+   PoolHandle(std::nullptr_t) {}
+
+   explicit PoolHandle(std::uint32_t handle_id)
+      : id(handle_id)
+   {}
+
+   Node* operator->() const {
+      return &NodePool<Node>::Instance()[id];
+   }
+
+   Node& operator*() const {
+      return NodePool<Node>::Instance()[id];
+   }
+
+   explicit operator bool() const {
+      return id != 0;
+   }
+
+   bool operator!() const {
+      return id == 0;
+   }
+
+   bool operator==(const PoolHandle& second) const {
+      return id == second.id;
+   }
+
+   bool operator!=(const PoolHandle& second) const {
+      return id != second.id;
+   }
+
+   std::uint32_t id = 0;
+};
+
+/*!
+ * Слябовый аллокатор вершин: вершины лежат массивами по kSlabSize, адреса не меняются.
+ * Таблица слябов фиксированного размера, поэтому разыменование ссылки не берёт блокировок.
+ * Свободные вершины сначала попадают в кэш потока, в общий список - пачками под мьютексом.
+ */
+template <typename Node>
+class NodePool {
+public:
+   // Крупные вершины (узлы B-дерева) - слябами поменьше, чтобы первый сляб не занимал десятки мегабайт
+   static constexpr std::uint32_t kSlabShift = sizeof(Node) <= 64 ? 16 : 12;
+   static constexpr std::uint32_t kSlabSize = 1u << kSlabShift;
+   static constexpr std::uint32_t kMaxSlabs = 1u << 16;
+   static constexpr std::uint64_t kMaxId = std::min<std::uint64_t>(UINT32_MAX, std::uint64_t(kMaxSlabs) << kSlabShift);
+   static constexpr size_t kCacheSize = 256;
+
+   static NodePool& Instance() {
+      static NodePool pool;
+      return pool;
+   }
+
+   ~NodePool() {
+      Destroyed().store(true, std::memory_order_release);
+      for (std::uint32_t i = 0; i < kMaxSlabs; ++i) {
+         delete[] slabs[i].load(std::memory_order_relaxed);
+      }
+   }
+
+   PoolHandle<Node> Allocate() {
+      LocalCache& cache = Cache();
+      if (cache.handles.empty()) {
+         Refill(cache);
+      }
+      PoolHandle<Node> res = cache.handles.back();
+      cache.handles.pop_back();
+
+      Node& node = (*this)[res.id];
+      node.~Node();
+      new (&node) Node();
+      live_nodes.fetch_add(1, std::memory_order_relaxed);
+      return res;
+   }
+
+   void Free(PoolHandle<Node> handle) {
+      LocalCache& cache = Cache();
+      cache.handles.push_back(handle);
+      live_nodes.fetch_sub(1, std::memory_order_relaxed);
+      if (cache.handles.size() >= 2 * kCacheSize) {
+         Flush(cache, kCacheSize);
+      }
+   }
+
+   Node& operator[](std::uint32_t id) {
+      return slabs[(id - 1) >> kSlabShift].load(std::memory_order_acquire)[(id - 1) & (kSlabSize - 1)];
+   }
+
+   size_t LiveNodes() const {
+      return live_nodes.load(std::memory_order_relaxed);
+   }
+
+   size_t BytesReserved() const {
+      return slab_count.load(std::memory_order_relaxed) * kSlabSize * sizeof(Node);
+   }
+
+private:
+   struct LocalCache {
+      std::vector<PoolHandle<Node>> handles;
+
+      // Потоки могут завершаться после разрушения пула (например, потоки статического ForkJoinPool):
+      // тогда вершины кэша уже освобождены вместе со слябами и отдавать их некуда
+      ~LocalCache() {
+         if (!Destroyed().load(std::memory_order_acquire)) {
+            NodePool::Instance().Flush(*this, 0);
+         }
+      }
+   };
+
+   std::unique_ptr<std::atomic<Node*>[]> slabs{new std::atomic<Node*>[kMaxSlabs]()};
+   std::atomic<size_t> slab_count{0};
+   std::atomic<size_t> live_nodes{0};
+
+   std::mutex m_;
+   std::vector<PoolHandle<Node>> free_handles;
+   std::uint64_t next_id = 1;
+
+   NodePool() = default;
+
+   // Тривиально разрушаемый флаг остаётся доступен и после разрушения статического пула
+   static std::atomic<bool>& Destroyed() {
+      static std::atomic<bool> destroyed{false};
+      return destroyed;
+   }
+
+   static LocalCache& Cache() {
+      thread_local LocalCache cache;
+      return cache;
+   }
+
+   void Refill(LocalCache& cache) {
+      std::lock_guard<std::mutex> locker(m_);
+      while (cache.handles.size() < kCacheSize && !free_handles.empty()) {
+         cache.handles.push_back(free_handles.back());
+         free_handles.pop_back();
+      }
+
+      while (cache.handles.size() < kCacheSize) {
+         if (next_id > kMaxId) {
+            if (cache.handles.empty()) {
+               throw std::bad_alloc();
+            }
+            return;
+         }
+
+         std::uint32_t slab = (next_id - 1) >> kSlabShift;
+         if (slabs[slab].load(std::memory_order_relaxed) == nullptr) {
+            slabs[slab].store(new Node[kSlabSize], std::memory_order_release);
+            slab_count.fetch_add(1, std::memory_order_relaxed);
+         }
+         cache.handles.push_back(PoolHandle<Node>(next_id++));
+      }
+   }
+
+   void Flush(LocalCache& cache, size_t keep) {
+      std::lock_guard<std::mutex> locker(m_);
+      while (cache.handles.size() > keep) {
+         free_handles.push_back(cache.handles.back());
+         cache.handles.pop_back();
+      }
+   }
+};
+
+#ifndef TREAP_NODEPOOL_H
+#define TREAP_NODEPOOL_H
+
+#endif //TREAP_NODEPOOL_H
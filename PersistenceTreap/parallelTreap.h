@@ -0,0 +1,137 @@
+#pragma once
+
+#include <vector>
+
+#include "forkJoin.h"
+#include "treap.h"
+
+/*!
+ * Параллельные операции над целыми версиями: построение, склейка многих деревьев, разрезание на много частей.
+ * Рекурсия идёт по независимым поддеревьям через ForkJoinPool, ниже cutoff элементов - последовательно.
+ * Части, с которыми работают разные задачи, не пересекаются по собственным вершинам:
+ * вершина с link == 1 принадлежит одной задаче, общие вершины только читаются и копируются.
+ */
+constexpr int kParallelCutoff = 1 << 14;
+
+template <typename Node>
+inline PoolHandle<Node> ParallelBuildImpl(const typename Node::value_type* values, int count, int cutoff) {
+   if (count <= cutoff) {
+      return Build<Node>(values, count);
+   }
+
+   int mid = count / 2;
+   PoolHandle<Node> left;
+   PoolHandle<Node> right;
+   ForkJoinPool::Instance().Invoke(
+      [&]() { left = ParallelBuildImpl<Node>(values, mid, cutoff); },
+      [&]() { right = ParallelBuildImpl<Node>(values + mid + 1, count - mid - 1, cutoff); });
+   return BuildJoin(left, values[mid], right);
+}
+
+// То же дерево, что у Build (форма и порядок кучи), половины строятся параллельно
+template <typename Node = PersistentTreap>
+inline PoolHandle<Node> ParallelBuild(const typename Node::value_type* values, int count,
+                                      int cutoff = kParallelCutoff) {
+   PROFILE_SCOPE("Treap::ParallelBuild")
+
+   if (count <= cutoff) {
+      return Build<Node>(values, count);
+   }
+
+   PoolHandle<Node> res;
+   ForkJoinPool::Instance().Run([&]() { res = ParallelBuildImpl<Node>(values, count, cutoff); });
+   return res;
+}
+
+template <typename Node = PersistentTreap>
+inline PoolHandle<Node> ParallelBuild(const std::vector<typename Node::value_type>& values,
+                                      int cutoff = kParallelCutoff) {
+   return ParallelBuild<Node>(values.data(), values.size(), cutoff);
+}
+
+// Склейка parts[0..count) по порядку, забирает ссылки на части. size - суммарный размер частей
+template <typename Node>
+inline PoolHandle<Node> ConcatOwned(const PoolHandle<Node>* parts, int count, long long size, int cutoff) {
+   if (count == 0) {
+      return nullptr;
+   }
+   if (count == 1) {
+      return parts[0];
+   }
+
+   int mid = count / 2;
+   long long left_size = 0;
+   for (int i = 0; i < mid; ++i) {
+      left_size += getSize(parts[i]);
+   }
+
+   PoolHandle<Node> L;
+   PoolHandle<Node> R;
+   auto left = [&]() { L = ConcatOwned(parts, mid, left_size, cutoff); };
+   auto right = [&]() { R = ConcatOwned(parts + mid, count - mid, size - left_size, cutoff); };
+   if (size > cutoff) {
+      ForkJoinPool::Instance().Invoke(left, right);
+   } else {
+      left();
+      right();
+   }
+   return MergeOwned(L, R);
+}
+
+// Разрезание по неубывающим позициям cuts[0..count) (в координатах всего дерева, offset - начало root);
+// out получает count + 1 частей. Забирает ссылку на root
+template <typename Node>
+inline void SplitManyOwned(PoolHandle<Node> root, const int* cuts, int count, int offset,
+                           PoolHandle<Node>* out, int cutoff) {
+   if (count == 0) {
+      out[0] = root;
+      return;
+   }
+
+   int mid = count / 2;
+   int size = getSize(root);
+   PoolHandle<Node> L;
+   PoolHandle<Node> R;
+   SplitOwned(root, L, R, cuts[mid] - offset);
+
+   auto left = [&]() { SplitManyOwned(L, cuts, mid, offset, out, cutoff); };
+   auto right = [&]() { SplitManyOwned(R, cuts + mid + 1, count - mid - 1, cuts[mid], out + mid + 1, cutoff); };
+   if (size > cutoff && count > 1) {
+      ForkJoinPool::Instance().Invoke(left, right);
+   } else {
+      left();
+      right();
+   }
+}
+
+// Не забирают ссылки на аргументы, возвращают вершины с собственной ссылкой
+template <typename Node>
+inline PoolHandle<Node> Concat(const std::vector<PoolHandle<Node>>& parts, int cutoff = kParallelCutoff) {
+   PROFILE_SCOPE("Treap::Concat")
+
+   long long size = 0;
+   for (auto part : parts) {
+      addLink(part);
+      size += getSize(part);
+   }
+
+   PoolHandle<Node> res;
+   ForkJoinPool::Instance().Run([&]() { res = ConcatOwned(parts.data(), parts.size(), size, cutoff); });
+   return res;
+}
+
+template <typename Node>
+inline std::vector<PoolHandle<Node>> SplitMany(PoolHandle<Node> root, const std::vector<int>& cuts,
+                                               int cutoff = kParallelCutoff) {
+   PROFILE_SCOPE("Treap::SplitMany")
+
+   std::vector<PoolHandle<Node>> res(cuts.size() + 1);
+   addLink(root);
+   ForkJoinPool::Instance().Run([&]() { SplitManyOwned(root, cuts.data(), cuts.size(), 0, res.data(), cutoff); });
+   return res;
+}
+
+#ifndef TREAP_PARALLELTREAP_H
+#define TREAP_PARALLELTREAP_H
+
+#endif //TREAP_PARALLELTREAP_H
@@ -0,0 +1,1015 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+#include "nodePool.h"
+#include "profiler.h"
+#include "versionHeap.h"
+
+/*!
+ * Персистентная верёвка на B+-дереве с неявным ключом: значения лежат в листьях по kRopeLeafSize,
+ * все листья на одной глубине. Обновление копирует путь из узлов, а не из вершин,
+ * поэтому на 10M элементов это 4-5 узлов вместо ~30 вершин декартова дерева.
+ */
+constexpr int kRopeLeafSize = 64;
+constexpr int kRopeFanout = 32;
+
+struct RopeLeaf {
+   std::atomic<std::uint32_t> link{0};
+   std::uint32_t count = 0;
+   long long values[kRopeLeafSize];
+};
+
+// По каждому ребёнку: размер, сумма (уже с учётом add) и отложенная прибавка add для его поддерева.
+// У узла высоты 1 дети - листья, у остальных - внутренние узлы
+struct RopeInner {
+   std::atomic<std::uint32_t> link{0};
+   std::uint32_t count = 0;
+   std::uint32_t child[kRopeFanout];
+   std::uint32_t size[kRopeFanout];
+   long long sum[kRopeFanout];
+   long long add[kRopeFanout];
+};
+
+// Ссылка на корень: по высоте понятно, в каком пуле лежит узел (0 - лист)
+struct RopePtr {
+   RopePtr() = default;
+   RopePtr(std::nullptr_t) {}
+
+   RopePtr(std::uint32_t node_id, std::uint32_t node_height)
+      : id(node_id)
+      , height(node_height)
+   {}
+
+   explicit operator bool() const {
+      return id != 0;
+   }
+
+   bool operator!() const {
+      return id == 0;
+   }
+
+   std::uint32_t id = 0;
+   std::uint32_t height = 0;
+};
+
+// Узел после изменения: его размер и сумма для записи в родителя
+struct RopePart {
+   std::uint32_t id = 0;
+   std::uint32_t size = 0;
+   long long sum = 0;
+};
+
+inline RopeLeaf& RopeLeafAt(std::uint32_t id) {
+   return NodePool<RopeLeaf>::Instance()[id];
+}
+
+inline RopeInner& RopeInnerAt(std::uint32_t id) {
+   return NodePool<RopeInner>::Instance()[id];
+}
+
+inline std::uint32_t RopeNewLeaf() {
+   PoolHandle<RopeLeaf> res = NodePool<RopeLeaf>::Instance().Allocate();
+   res->link.store(1, std::memory_order_relaxed);
+   return res.id;
+}
+
+inline std::uint32_t RopeNewInner() {
+   PoolHandle<RopeInner> res = NodePool<RopeInner>::Instance().Allocate();
+   res->link.store(1, std::memory_order_relaxed);
+   return res.id;
+}
+
+inline void RopeAddRef(std::uint32_t id, std::uint32_t height) {
+   if (!id) {
+      return;
+   }
+
+   std::atomic<std::uint32_t>& link = height == 0 ? RopeLeafAt(id).link : RopeInnerAt(id).link;
+   link.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void RopeRelease(std::uint32_t id, std::uint32_t height) {
+   if (!id) {
+      return;
+   }
+
+   if (height == 0) {
+      if (RopeLeafAt(id).link.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+         NodePool<RopeLeaf>::Instance().Free(PoolHandle<RopeLeaf>(id));
+      }
+      return;
+   }
+
+   RopeInner& node = RopeInnerAt(id);
+   if (node.link.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      for (std::uint32_t i = 0; i < node.count; ++i) {
+         RopeRelease(node.child[i], height - 1);
+      }
+      NodePool<RopeInner>::Instance().Free(PoolHandle<RopeInner>(id));
+   }
+}
+
+// Перенос n записей, диапазоны могут перекрываться; ссылки на детей не меняются
+inline void RopeMoveValues(const RopeLeaf& from, int from_pos, RopeLeaf& to, int to_pos, int n) {
+   std::memmove(to.values + to_pos, from.values + from_pos, n * sizeof(long long));
+}
+
+inline void RopeMoveEntries(const RopeInner& from, int from_pos, RopeInner& to, int to_pos, int n) {
+   std::memmove(to.child + to_pos, from.child + from_pos, n * sizeof(std::uint32_t));
+   std::memmove(to.size + to_pos, from.size + from_pos, n * sizeof(std::uint32_t));
+   std::memmove(to.sum + to_pos, from.sum + from_pos, n * sizeof(long long));
+   std::memmove(to.add + to_pos, from.add + from_pos, n * sizeof(long long));
+}
+
+// Забирают ссылку: узел с link == 1 меняется на месте, общий копируется
+inline std::uint32_t RopeOwnLeaf(std::uint32_t id) {
+   if (RopeLeafAt(id).link.load(std::memory_order_acquire) == 1) {
+      return id;
+   }
+
+   std::uint32_t res = RopeNewLeaf();
+   RopeLeaf& node = RopeLeafAt(res);
+   const RopeLeaf& src = RopeLeafAt(id);
+   node.count = src.count;
+   RopeMoveValues(src, 0, node, 0, src.count);
+   RopeRelease(id, 0);
+
+   return res;
+}
+
+inline std::uint32_t RopeOwnInner(std::uint32_t id, std::uint32_t height) {
+   if (RopeInnerAt(id).link.load(std::memory_order_acquire) == 1) {
+      return id;
+   }
+
+   std::uint32_t res = RopeNewInner();
+   RopeInner& node = RopeInnerAt(res);
+   const RopeInner& src = RopeInnerAt(id);
+   node.count = src.count;
+   RopeMoveEntries(src, 0, node, 0, src.count);
+   for (std::uint32_t i = 0; i < node.count; ++i) {
+      RopeAddRef(node.child[i], height - 1);
+   }
+   RopeRelease(id, height);
+
+   return res;
+}
+
+inline RopePart RopeLeafPart(std::uint32_t id) {
+   const RopeLeaf& leaf = RopeLeafAt(id);
+   RopePart res{id, leaf.count, 0};
+   for (std::uint32_t i = 0; i < leaf.count; ++i) {
+      res.sum += leaf.values[i];
+   }
+   return res;
+}
+
+inline RopePart RopeInnerPart(std::uint32_t id) {
+   const RopeInner& node = RopeInnerAt(id);
+   RopePart res{id, 0, 0};
+   for (std::uint32_t i = 0; i < node.count; ++i) {
+      res.size += node.size[i];
+      res.sum += node.sum[i];
+   }
+   return res;
+}
+
+inline RopePart RopeNodePart(std::uint32_t id, std::uint32_t height) {
+   return height == 0 ? RopeLeafPart(id) : RopeInnerPart(id);
+}
+
+inline void RopeSetChild(RopeInner& node, int i, const RopePart& part) {
+   node.child[i] = part.id;
+   node.size[i] = part.size;
+   node.sum[i] = part.sum + node.add[i] * part.size;
+}
+
+// Номер ребёнка, в котором лежит позиция index; index становится позицией внутри ребёнка.
+// Префиксные суммы размеров и подсчёт без ветвлений, второй цикл компилятор векторизует.
+// Позиция за концом попадает в последнего ребёнка (для вставки в конец)
+inline int RopeFindChild(const RopeInner& node, std::uint32_t& index) {
+   std::uint32_t end[kRopeFanout];
+   std::uint32_t acc = 0;
+   for (int i = 0; i < kRopeFanout; ++i) {
+      acc += i < static_cast<int>(node.count) ? node.size[i] : 0;
+      end[i] = acc;
+   }
+
+   int pos = 0;
+   for (int i = 0; i < kRopeFanout; ++i) {
+      pos += end[i] <= index;
+   }
+   pos = std::min(pos, static_cast<int>(node.count) - 1);
+   index -= pos > 0 ? end[pos - 1] : 0;
+
+   return pos;
+}
+
+// Отложенная прибавка ребёнка переносится в него самого, ребёнок становится собственным
+inline void RopePushChild(RopeInner& node, int i, std::uint32_t height) {
+   long long delta = node.add[i];
+   if (delta == 0) {
+      return;
+   }
+
+   if (height == 1) {
+      std::uint32_t id = RopeOwnLeaf(node.child[i]);
+      RopeLeaf& leaf = RopeLeafAt(id);
+      for (std::uint32_t k = 0; k < leaf.count; ++k) {
+         leaf.values[k] += delta;
+      }
+      node.child[i] = id;
+   } else {
+      std::uint32_t id = RopeOwnInner(node.child[i], height - 1);
+      RopeInner& inner = RopeInnerAt(id);
+      for (std::uint32_t k = 0; k < inner.count; ++k) {
+         inner.add[k] += delta;
+         inner.sum[k] += delta * inner.size[k];
+      }
+      node.child[i] = id;
+   }
+   node.add[i] = 0;
+}
+
+// Вставка записи на позицию pos собственного узла; полный узел делится пополам, правая половина возвращается
+inline RopePart RopeInnerInsert(std::uint32_t id, int pos, const RopePart& part) {
+   std::uint32_t target = id;
+   std::uint32_t right_id = 0;
+   if (RopeInnerAt(id).count == kRopeFanout) {
+      right_id = RopeNewInner();
+      RopeInner& node = RopeInnerAt(id);
+      RopeInner& right = RopeInnerAt(right_id);
+      int half = kRopeFanout / 2;
+      RopeMoveEntries(node, half, right, 0, kRopeFanout - half);
+      right.count = kRopeFanout - half;
+      node.count = half;
+      if (pos > half) {
+         target = right_id;
+         pos -= half;
+      }
+   }
+
+   RopeInner& node = RopeInnerAt(target);
+   RopeMoveEntries(node, pos, node, pos + 1, node.count - pos);
+   node.add[pos] = 0;
+   RopeSetChild(node, pos, part);
+   node.count++;
+
+   return right_id ? RopeInnerPart(right_id) : RopePart();
+}
+
+struct RopeInsertResult {
+   RopePart left;
+   RopePart right;
+};
+
+// Рекурсивные функции ниже забирают ссылку на узел и возвращают собственный узел
+inline RopeInsertResult RopeInsertRec(std::uint32_t id, std::uint32_t height, std::uint32_t index, long long x) {
+   if (height == 0) {
+      id = RopeOwnLeaf(id);
+      std::uint32_t target = id;
+      std::uint32_t right_id = 0;
+      if (RopeLeafAt(id).count == kRopeLeafSize) {
+         right_id = RopeNewLeaf();
+         RopeLeaf& leaf = RopeLeafAt(id);
+         RopeLeaf& right = RopeLeafAt(right_id);
+         int half = kRopeLeafSize / 2;
+         RopeMoveValues(leaf, half, right, 0, kRopeLeafSize - half);
+         right.count = kRopeLeafSize - half;
+         leaf.count = half;
+         if (index > static_cast<std::uint32_t>(half)) {
+            target = right_id;
+            index -= half;
+         }
+      }
+
+      RopeLeaf& leaf = RopeLeafAt(target);
+      RopeMoveValues(leaf, index, leaf, index + 1, leaf.count - index);
+      leaf.values[index] = x;
+      leaf.count++;
+
+      return {RopeLeafPart(id), right_id ? RopeLeafPart(right_id) : RopePart()};
+   }
+
+   id = RopeOwnInner(id, height);
+   RopeInner& node = RopeInnerAt(id);
+   int i = RopeFindChild(node, index);
+   RopePushChild(node, i, height);
+   RopeInsertResult res = RopeInsertRec(node.child[i], height - 1, index, x);
+   RopeSetChild(node, i, res.left);
+
+   RopePart right;
+   if (res.right.id) {
+      right = RopeInnerInsert(id, i + 1, res.right);
+   }
+   return {RopeInnerPart(id), right};
+}
+
+// Ребёнок i заполнен меньше чем на четверть: сливается с соседом или забирает у него половину разницы
+inline void RopeRebalance(RopeInner& node, int i, std::uint32_t height) {
+   if (node.count < 2) {
+      return;
+   }
+
+   int a = i + 1 < static_cast<int>(node.count) ? i : i - 1;
+   int b = a + 1;
+   RopePushChild(node, a, height);
+   RopePushChild(node, b, height);
+   node.child[a] = height == 1 ? RopeOwnLeaf(node.child[a]) : RopeOwnInner(node.child[a], height - 1);
+   node.child[b] = height == 1 ? RopeOwnLeaf(node.child[b]) : RopeOwnInner(node.child[b], height - 1);
+
+   bool merged;
+   if (height == 1) {
+      RopeLeaf& left = RopeLeafAt(node.child[a]);
+      RopeLeaf& right = RopeLeafAt(node.child[b]);
+      int total = left.count + right.count;
+      int want = total / 2;
+      merged = total <= kRopeLeafSize;
+      if (merged) {
+         RopeMoveValues(right, 0, left, left.count, right.count);
+         left.count = total;
+         right.count = 0;
+      } else if (static_cast<int>(left.count) < want) {
+         int n = want - left.count;
+         RopeMoveValues(right, 0, left, left.count, n);
+         RopeMoveValues(right, n, right, 0, right.count - n);
+         left.count += n;
+         right.count -= n;
+      } else {
+         int n = left.count - want;
+         RopeMoveValues(right, 0, right, n, right.count);
+         RopeMoveValues(left, want, right, 0, n);
+         left.count = want;
+         right.count += n;
+      }
+   } else {
+      RopeInner& left = RopeInnerAt(node.child[a]);
+      RopeInner& right = RopeInnerAt(node.child[b]);
+      int total = left.count + right.count;
+      int want = total / 2;
+      merged = total <= kRopeFanout;
+      if (merged) {
+         RopeMoveEntries(right, 0, left, left.count, right.count);
+         left.count = total;
+         right.count = 0;
+      } else if (static_cast<int>(left.count) < want) {
+         int n = want - left.count;
+         RopeMoveEntries(right, 0, left, left.count, n);
+         RopeMoveEntries(right, n, right, 0, right.count - n);
+         left.count += n;
+         right.count -= n;
+      } else {
+         int n = left.count - want;
+         RopeMoveEntries(right, 0, right, n, right.count);
+         RopeMoveEntries(left, want, right, 0, n);
+         left.count = want;
+         right.count += n;
+      }
+   }
+
+   if (merged) {
+      // у пустого правого узла детей нет, освобождается только он сам
+      RopeRelease(node.child[b], height - 1);
+      RopeMoveEntries(node, b + 1, node, b, node.count - b - 1);
+      node.count--;
+   } else {
+      RopeSetChild(node, b, RopeNodePart(node.child[b], height - 1));
+   }
+   RopeSetChild(node, a, RopeNodePart(node.child[a], height - 1));
+}
+
+inline std::uint32_t RopeCount(std::uint32_t id, std::uint32_t height) {
+   return height == 0 ? RopeLeafAt(id).count : RopeInnerAt(id).count;
+}
+
+inline RopePart RopeRemoveRec(std::uint32_t id, std::uint32_t height, std::uint32_t index) {
+   if (height == 0) {
+      id = RopeOwnLeaf(id);
+      RopeLeaf& leaf = RopeLeafAt(id);
+      RopeMoveValues(leaf, index + 1, leaf, index, leaf.count - index - 1);
+      leaf.count--;
+      return RopeLeafPart(id);
+   }
+
+   id = RopeOwnInner(id, height);
+   RopeInner& node = RopeInnerAt(id);
+   int i = RopeFindChild(node, index);
+   RopeSetChild(node, i, RopeRemoveRec(node.child[i], height - 1, index));
+
+   std::uint32_t capacity = height == 1 ? kRopeLeafSize : kRopeFanout;
+   if (RopeCount(node.child[i], height - 1) < capacity / 4) {
+      RopeRebalance(node, i, height);
+   }
+   return RopeInnerPart(id);
+}
+
+// l и r - относительно начала поддерева; полностью покрытый ребёнок получает только add в родителе
+inline RopePart RopeRangeAddRec(std::uint32_t id, std::uint32_t height, long long l, long long r, long long delta) {
+   if (height == 0) {
+      id = RopeOwnLeaf(id);
+      RopeLeaf& leaf = RopeLeafAt(id);
+      long long last = std::min<long long>(r, leaf.count - 1);
+      for (long long k = std::max<long long>(l, 0); k <= last; ++k) {
+         leaf.values[k] += delta;
+      }
+      return RopeLeafPart(id);
+   }
+
+   id = RopeOwnInner(id, height);
+   RopeInner& node = RopeInnerAt(id);
+   long long offset = 0;
+   for (std::uint32_t i = 0; i < node.count && offset <= r; ++i) {
+      long long end = offset + node.size[i] - 1;
+      if (end >= l) {
+         if (l <= offset && end <= r) {
+            node.add[i] += delta;
+            node.sum[i] += delta * node.size[i];
+         } else {
+            RopeSetChild(node, i, RopeRangeAddRec(node.child[i], height - 1, l - offset, r - offset, delta));
+         }
+      }
+      offset += node.size[i];
+   }
+   return RopeInnerPart(id);
+}
+
+inline int RopeSize(RopePtr root);
+
+// Версии, забирающие ссылку на корень.
+// Индексы как у декартова дерева: вставка за границами - в начало или конец, удаление за границами ничего не делает
+inline RopePtr RopeInsertOwned(RopePtr root, int index, long long x) {
+   index = std::max(0, std::min(index, RopeSize(root)));
+   if (!root) {
+      std::uint32_t leaf = RopeNewLeaf();
+      RopeLeafAt(leaf).values[0] = x;
+      RopeLeafAt(leaf).count = 1;
+      return RopePtr(leaf, 0);
+   }
+
+   RopeInsertResult res = RopeInsertRec(root.id, root.height, index, x);
+   if (!res.right.id) {
+      return RopePtr(res.left.id, root.height);
+   }
+
+   std::uint32_t top = RopeNewInner();
+   RopeInner& node = RopeInnerAt(top);
+   node.add[0] = node.add[1] = 0;
+   RopeSetChild(node, 0, res.left);
+   RopeSetChild(node, 1, res.right);
+   node.count = 2;
+   return RopePtr(top, root.height + 1);
+}
+
+inline RopePtr RopeRemoveOwned(RopePtr root, int index) {
+   if (index < 0 || index >= RopeSize(root)) {
+      return root;
+   }
+
+   RopePtr res(RopeRemoveRec(root.id, root.height, index).id, root.height);
+   while (res.height > 0 && RopeInnerAt(res.id).count == 1) {
+      RopeInner& node = RopeInnerAt(res.id);
+      RopePushChild(node, 0, res.height);
+      std::uint32_t child = node.child[0];
+      node.count = 0;
+      RopeRelease(res.id, res.height);
+      res = RopePtr(child, res.height - 1);
+   }
+   if (res.height == 0 && RopeLeafAt(res.id).count == 0) {
+      RopeRelease(res.id, 0);
+      return nullptr;
+   }
+
+   return res;
+}
+
+inline RopePtr RopeRangeAddOwned(RopePtr root, int l, int r, long long delta) {
+   if (!root || l > r) {
+      return root;
+   }
+
+   return RopePtr(RopeRangeAddRec(root.id, root.height, l, r, delta).id, root.height);
+}
+
+// Листья, заполненные поровну, для values[0..count)
+inline void RopeBuildLeaves(const long long* values, int count, std::vector<RopePart>& level) {
+   int leaves = (count + kRopeLeafSize - 1) / kRopeLeafSize;
+   for (int i = 0, pos = 0; i < leaves; ++i) {
+      int n = (count - pos) / (leaves - i);
+      std::uint32_t leaf = RopeNewLeaf();
+      std::copy(values + pos, values + pos + n, RopeLeafAt(leaf).values);
+      RopeLeafAt(leaf).count = n;
+      level.push_back(RopeLeafPart(leaf));
+      pos += n;
+   }
+}
+
+// Уровни над частями высоты height, пока не останется один корень
+inline RopePtr RopeBuildLevels(std::vector<RopePart> level, std::uint32_t height) {
+   while (level.size() > 1) {
+      std::vector<RopePart> next;
+      int total = level.size();
+      int groups = (total + kRopeFanout - 1) / kRopeFanout;
+      for (int g = 0, pos = 0; g < groups; ++g) {
+         int n = (total - pos) / (groups - g);
+         std::uint32_t id = RopeNewInner();
+         RopeInner& node = RopeInnerAt(id);
+         for (int k = 0; k < n; ++k) {
+            node.add[k] = 0;
+            RopeSetChild(node, k, level[pos + k]);
+         }
+         node.count = n;
+         next.push_back(RopeInnerPart(id));
+         pos += n;
+      }
+      level.swap(next);
+      ++height;
+   }
+
+   return RopePtr(level[0].id, height);
+}
+
+// Дерево из массива за O(n): листья и узлы заполняются поровну снизу вверх
+inline RopePtr RopeBuild(const long long* values, int count) {
+   if (count <= 0) {
+      return nullptr;
+   }
+
+   std::vector<RopePart> level;
+   RopeBuildLeaves(values, count, level);
+   return RopeBuildLevels(std::move(level), 0);
+}
+
+// Вставка блока: лист с позицией index пересобирается вместе с блоком, новые части вставляются в родителей.
+// Возвращает части, заменяющие узел; их больше одной, если узел переполнился. O(count + log n) узлов
+inline std::vector<RopePart> RopeInsertRangeRec(std::uint32_t id, std::uint32_t height, std::uint32_t index,
+                                                const long long* values, int count) {
+   std::vector<RopePart> res;
+   if (height == 0) {
+      const RopeLeaf& leaf = RopeLeafAt(id);
+      if (leaf.count + static_cast<std::uint32_t>(count) <= kRopeLeafSize) {
+         id = RopeOwnLeaf(id);
+         RopeLeaf& own = RopeLeafAt(id);
+         RopeMoveValues(own, index, own, index + count, own.count - index);
+         std::copy(values, values + count, own.values + index);
+         own.count += count;
+         res.push_back(RopeLeafPart(id));
+         return res;
+      }
+
+      std::vector<long long> merged(leaf.values, leaf.values + index);
+      merged.insert(merged.end(), values, values + count);
+      merged.insert(merged.end(), leaf.values + index, leaf.values + leaf.count);
+      RopeRelease(id, 0);
+      RopeBuildLeaves(merged.data(), merged.size(), res);
+      return res;
+   }
+
+   id = RopeOwnInner(id, height);
+   RopeInner& node = RopeInnerAt(id);
+   int i = RopeFindChild(node, index);
+   RopePushChild(node, i, height);
+   std::vector<RopePart> parts = RopeInsertRangeRec(node.child[i], height - 1, index, values, count);
+   if (parts.size() == 1) {
+      RopeSetChild(node, i, parts[0]);
+      res.push_back(RopeInnerPart(id));
+      return res;
+   }
+
+   // Записи узла с частями вместо ребёнка i; ссылки на детей переходят в новые узлы как есть
+   struct Entry {
+      std::uint32_t child;
+      std::uint32_t size;
+      long long sum;
+      long long add;
+   };
+   std::vector<Entry> entries;
+   entries.reserve(node.count - 1 + parts.size());
+   for (int k = 0; k < static_cast<int>(node.count); ++k) {
+      if (k != i) {
+         entries.push_back(Entry{node.child[k], node.size[k], node.sum[k], node.add[k]});
+         continue;
+      }
+      for (const RopePart& part : parts) {
+         entries.push_back(Entry{part.id, part.size, part.sum, 0});
+      }
+   }
+
+   int total = entries.size();
+   int groups = (total + kRopeFanout - 1) / kRopeFanout;
+   for (int g = 0, pos = 0; g < groups; ++g) {
+      int n = (total - pos) / (groups - g);
+      std::uint32_t target = g == 0 ? id : RopeNewInner();
+      RopeInner& to = RopeInnerAt(target);
+      for (int k = 0; k < n; ++k) {
+         const Entry& e = entries[pos + k];
+         to.child[k] = e.child;
+         to.size[k] = e.size;
+         to.sum[k] = e.sum;
+         to.add[k] = e.add;
+      }
+      to.count = n;
+      res.push_back(RopeInnerPart(target));
+      pos += n;
+   }
+   return res;
+}
+
+inline RopePtr RopeInsertRangeOwned(RopePtr root, int index, const long long* values, int count) {
+   if (count <= 0) {
+      return root;
+   }
+   if (!root) {
+      return RopeBuild(values, count);
+   }
+
+   index = std::max(0, std::min(index, RopeSize(root)));
+   return RopeBuildLevels(RopeInsertRangeRec(root.id, root.height, index, values, count), root.height);
+}
+
+// Функции ниже не забирают ссылку на корень и возвращают корень с собственной ссылкой
+inline RopePtr RopeInsert(RopePtr root, int index, long long x) {
+   PROFILE_SCOPE("Rope::Insert")
+
+   RopeAddRef(root.id, root.height);
+   return RopeInsertOwned(root, index, x);
+}
+
+inline RopePtr RopeInsertRange(RopePtr root, int index, const long long* values, int count) {
+   PROFILE_SCOPE("Rope::InsertRange")
+
+   RopeAddRef(root.id, root.height);
+   return RopeInsertRangeOwned(root, index, values, count);
+}
+
+inline RopePtr RopeRemove(RopePtr root, int index) {
+   PROFILE_SCOPE("Rope::Remove")
+
+   RopeAddRef(root.id, root.height);
+   return RopeRemoveOwned(root, index);
+}
+
+inline RopePtr RopeRangeAdd(RopePtr root, int l, int r, long long delta) {
+   PROFILE_SCOPE("Rope::RangeAdd")
+
+   RopeAddRef(root.id, root.height);
+   return RopeRangeAddOwned(root, l, r, delta);
+}
+
+// ops отсортированы по индексу и применяются с конца: операция не сдвигает индексы тех, что левее.
+// Путь копируется один раз, дальше узлы собственные и меняются на месте.
+// Повторное удаление того же индекса исходной версии пропускается, как у дерамиды
+inline RopePtr RopeApplyBatch(RopePtr root, const BatchOp<long long>* ops, int count) {
+   PROFILE_SCOPE("Rope::ApplyBatch")
+
+   using Op = BatchOp<long long>;
+   RopeAddRef(root.id, root.height);
+   for (int i = count - 1; i >= 0; --i) {
+      if (ops[i].kind == Op::Insert) {
+         root = RopeInsertOwned(root, ops[i].index, ops[i].value);
+      } else if (i == 0 || ops[i - 1].kind != Op::Remove || ops[i - 1].index != ops[i].index) {
+         root = RopeRemoveOwned(root, ops[i].index);
+      }
+   }
+   return root;
+}
+
+// Чтение без аллокаций, pending - сумма прибавок на пути от корня
+inline int RopeSize(RopePtr root) {
+   return root ? RopeNodePart(root.id, root.height).size : 0;
+}
+
+inline long long RopeGet(RopePtr root, int index) {
+   if (index < 0 || index >= RopeSize(root)) {
+      return 0;
+   }
+
+   std::uint32_t id = root.id;
+   std::uint32_t pos = index;
+   long long pending = 0;
+   for (std::uint32_t height = root.height; height > 0; --height) {
+      const RopeInner& node = RopeInnerAt(id);
+      int i = RopeFindChild(node, pos);
+      pending += node.add[i];
+      id = node.child[i];
+   }
+
+   return RopeLeafAt(id).values[pos] + pending;
+}
+
+inline long long RopePrefixSum(RopePtr root, int count) {
+   count = std::min(count, RopeSize(root));
+   if (count <= 0) {
+      return 0;
+   }
+
+   std::uint32_t id = root.id;
+   std::uint32_t pos = count;
+   long long res = 0, pending = 0;
+   for (std::uint32_t height = root.height; height > 0; --height) {
+      const RopeInner& node = RopeInnerAt(id);
+      int i = RopeFindChild(node, pos);
+      for (int k = 0; k < i; ++k) {
+         res += node.sum[k] + pending * node.size[k];
+      }
+      pending += node.add[i];
+      id = node.child[i];
+   }
+
+   const RopeLeaf& leaf = RopeLeafAt(id);
+   for (std::uint32_t k = 0; k < pos; ++k) {
+      res += leaf.values[k];
+   }
+   return res + pending * pos;
+}
+
+inline long long RopeGetSum(RopePtr root, int l, int r) {
+   PROFILE_SCOPE("Rope::GetSum")
+
+   if (l > r) {
+      return 0;
+   }
+   return RopePrefixSum(root, r + 1) - RopePrefixSum(root, l);
+}
+
+// Первый индекс, на котором сумма префикса достигает target (значения неотрицательны), или размер
+inline int RopeLowerBoundPrefixSum(RopePtr root, long long target) {
+   if (!root) {
+      return 0;
+   }
+
+   std::uint32_t id = root.id;
+   int index = 0;
+   long long before = 0, pending = 0;
+   for (std::uint32_t height = root.height; height > 0; --height) {
+      const RopeInner& node = RopeInnerAt(id);
+      std::uint32_t i = 0;
+      for (; i < node.count; ++i) {
+         long long total = node.sum[i] + pending * node.size[i];
+         if (before + total >= target) {
+            break;
+         }
+         before += total;
+         index += node.size[i];
+      }
+      if (i == node.count) {
+         return index;
+      }
+      pending += node.add[i];
+      id = node.child[i];
+   }
+
+   const RopeLeaf& leaf = RopeLeafAt(id);
+   for (std::uint32_t k = 0; k < leaf.count; ++k) {
+      before += leaf.values[k] + pending;
+      if (before >= target) {
+         return index + k;
+      }
+   }
+   return index + leaf.count;
+}
+
+template <typename Func>
+void RopeForEachRec(std::uint32_t id, std::uint32_t height, long long l, long long r, long long pending, Func& func) {
+   if (height == 0) {
+      const RopeLeaf& leaf = RopeLeafAt(id);
+      long long last = std::min<long long>(r, leaf.count - 1);
+      for (long long k = std::max<long long>(l, 0); k <= last; ++k) {
+         func(leaf.values[k] + pending);
+      }
+      return;
+   }
+
+   const RopeInner& node = RopeInnerAt(id);
+   long long offset = 0;
+   for (std::uint32_t i = 0; i < node.count && offset <= r; ++i) {
+      if (offset + node.size[i] - 1 >= l) {
+         RopeForEachRec(node.child[i], height - 1, l - offset, r - offset, pending + node.add[i], func);
+      }
+      offset += node.size[i];
+   }
+}
+
+template <typename Func>
+void RopeForEachInSegment(RopePtr root, int l, int r, Func&& func) {
+   if (root && l <= r) {
+      RopeForEachRec(root.id, root.height, l, r, 0, func);
+   }
+}
+
+inline std::ostream& RopePrintSegment(std::ostream& out, RopePtr root, int l, int r) {
+   PROFILE_SCOPE("Rope::PrintSegment")
+
+   RopeForEachInSegment(root, l, r, [&out](long long val) {
+      out << val << " ";
+   });
+
+   return out;
+}
+
+// Версия верёвки с тем же интерфейсом, что и TreapVersion
+class RopeVersion {
+public:
+   RopeVersion() = default;
+
+   explicit RopeVersion(RopePtr root)
+      : root_(root)
+   {
+      RopeAddRef(root_.id, root_.height);
+   }
+
+   // Забирает уже принадлежащую вызывающему ссылку
+   static RopeVersion Adopt(RopePtr root) {
+      RopeVersion res;
+      res.root_ = root;
+      return res;
+   }
+
+   RopeVersion(const RopeVersion& second)
+      : RopeVersion(second.root_)
+   {}
+
+   RopeVersion(RopeVersion&& second) noexcept
+      : root_(second.root_)
+   {
+      second.root_ = nullptr;
+   }
+
+   RopeVersion& operator=(RopeVersion second) {
+      std::swap(root_, second.root_);
+      return *this;
+   }
+
+   ~RopeVersion() {
+      RopeRelease(root_.id, root_.height);
+   }
+
+   RopePtr Root() const {
+      return root_;
+   }
+
+   int Size() const {
+      return RopeSize(root_);
+   }
+
+   long long GetSum(int l, int r) const {
+      return RopeGetSum(root_, l, r);
+   }
+
+   long long Get(int index) const {
+      return RopeGet(root_, index);
+   }
+
+   int LowerBoundPrefixSum(long long target) const {
+      return RopeLowerBoundPrefixSum(root_, target);
+   }
+
+   std::ostream& PrintSegment(std::ostream& out, int l, int r) const {
+      return RopePrintSegment(out, root_, l, r);
+   }
+
+private:
+   RopePtr root_;
+};
+
+// Пачка изменений на месте, как TreapTransient
+class RopeTransient {
+public:
+   RopeTransient() = default;
+
+   explicit RopeTransient(const RopeVersion& base)
+      : root_(base.Root())
+   {
+      RopeAddRef(root_.id, root_.height);
+   }
+
+   RopeTransient(const RopeTransient&) = delete;
+   RopeTransient& operator=(const RopeTransient&) = delete;
+
+   ~RopeTransient() {
+      RopeRelease(root_.id, root_.height);
+   }
+
+   void Insert(int index, long long x) {
+      root_ = RopeInsertOwned(root_, index, x);
+   }
+
+   void InsertRange(int index, const long long* values, int count) {
+      root_ = RopeInsertRangeOwned(root_, index, values, count);
+   }
+
+   void Remove(int index) {
+      root_ = RopeRemoveOwned(root_, index);
+   }
+
+   void RangeAdd(int l, int r, long long delta) {
+      root_ = RopeRangeAddOwned(root_, l, r, delta);
+   }
+
+   int Size() const {
+      return RopeSize(root_);
+   }
+
+   long long GetSum(int l, int r) const {
+      return RopeGetSum(root_, l, r);
+   }
+
+   long long Get(int index) const {
+      return RopeGet(root_, index);
+   }
+
+   RopeVersion Freeze() const {
+      return RopeVersion(root_);
+   }
+
+private:
+   RopePtr root_;
+};
+
+// Операции верёвки для BasicVersionHeap
+struct RopeOps {
+   using Handle = RopePtr;
+   using Version = RopeVersion;
+   using Transient = RopeTransient;
+   using value_type = long long;
+   using aggregate_type = long long;
+   using tag_type = long long;
+
+   static Handle Build(const std::vector<long long>& values) {
+      return RopeBuild(values.data(), values.size());
+   }
+
+   static Handle Insert(Handle root, int index, long long x) {
+      return RopeInsert(root, index, x);
+   }
+
+   static Handle InsertRange(Handle root, int index, const long long* values, int count) {
+      return RopeInsertRange(root, index, values, count);
+   }
+
+   static Handle Remove(Handle root, int index) {
+      return RopeRemove(root, index);
+   }
+
+   static Handle RangeAdd(Handle root, int l, int r, long long delta) {
+      return RopeRangeAdd(root, l, r, delta);
+   }
+
+   static Handle ApplyBatch(Handle root, const BatchOp<long long>* ops, int count) {
+      return RopeApplyBatch(root, ops, count);
+   }
+
+   static void AddRef(Handle root) {
+      RopeAddRef(root.id, root.height);
+   }
+
+   static void Release(Handle root) {
+      RopeRelease(root.id, root.height);
+   }
+
+   // Листья и внутренние узлы лежат в разных пулах, поэтому ключ включает высоту
+   static std::uint64_t NodeKey(Handle node) {
+      return (std::uint64_t(node.height) << 32) | node.id;
+   }
+
+   static size_t NodeBytes(Handle node) {
+      return node.height == 0 ? sizeof(RopeLeaf) : sizeof(RopeInner);
+   }
+
+   template <typename Func>
+   static void ForEachChild(Handle node, Func&& visit) {
+      if (node.height == 0) {
+         return;
+      }
+      const RopeInner& inner = RopeInnerAt(node.id);
+      for (std::uint32_t i = 0; i < inner.count; ++i) {
+         visit(RopePtr(inner.child[i], node.height - 1));
+      }
+   }
+
+   static size_t LiveNodes() {
+      return NodePool<RopeLeaf>::Instance().LiveNodes() + NodePool<RopeInner>::Instance().LiveNodes();
+   }
+
+   static size_t LiveBytes() {
+      return NodePool<RopeLeaf>::Instance().LiveNodes() * sizeof(RopeLeaf)
+             + NodePool<RopeInner>::Instance().LiveNodes() * sizeof(RopeInner);
+   }
+
+   static size_t BytesReserved() {
+      return NodePool<RopeLeaf>::Instance().BytesReserved() + NodePool<RopeInner>::Instance().BytesReserved();
+   }
+};
+
+// Тот же версионный интерфейс, что у PTHeap
+using RopeHeap = BasicVersionHeap<RopeOps>;
+
+#ifndef TREAP_PERSISTENTROPE_H
+#define TREAP_PERSISTENTROPE_H
+
+#endif //TREAP_PERSISTENTROPE_H
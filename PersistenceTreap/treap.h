@@ -1,53 +1,63 @@
+#pragma once
+
 #include <iostream>
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <memory>
 #include <random>
 #include <sstream>
+#include <vector>
 
-struct PersistentTreap {
-
-   PersistentTreap() = default;
+#include "nodePool.h"
+#include "profiler.h"
+#include "treapPolicies.h"
 
-   PersistentTreap(PersistentTreap* cur) {
-      if (!cur) {
-         return;
-      }
-      left = cur->left;
-      right = cur->right;
-      sum = cur->sum;
-      val = cur->val;
-      size = cur->size;
-      add = cur->add;
-   }
-
-   PersistentTreap(int x) {
-      sum = x;
-      val = x;
-      size = 1;
-   }
-
-   void Del() {
-      link--;
-      if (link <= 0) {
-         if (left != nullptr)
-            left->Del();
-         if (right != nullptr)
-            right->Del();
-         delete this;
-      }
-   }
+// Поля агрегата и отложенной операции лежат в базах, выключенная политика даёт пустую базу
+template <typename Monoid, bool = Monoid::enabled>
+struct AggregateField {
+   typename Monoid::aggregate_type agg = Monoid::Identity();
+};
 
-   int link = 0;
-   int size = 0;
-   long long sum = 0, val = 0, add = 0;
+template <typename Monoid>
+struct AggregateField<Monoid, false> {};
 
-   PersistentTreap *left = nullptr;
-   PersistentTreap* right = nullptr;
+template <typename Lazy, bool = Lazy::enabled>
+struct LazyField {
+   typename Lazy::tag_type tag = Lazy::Identity();
+};
 
+template <typename Lazy>
+struct LazyField<Lazy, false> {};
+
+// link - число ссылок на вершину (родители и версии), prio - приоритет кучи, выдаётся при создании
+// val и agg уже учитывают tag, tag - отложенная операция для детей
+// Вершина с link > 1 неизменяема, поэтому общие поддеревья можно читать из разных потоков
+template <typename T, typename Monoid = SumMonoid<T>, typename Lazy = AddLazy<T>>
+struct BasicPersistentTreap : AggregateField<Monoid>, LazyField<Lazy> {
+   using value_type = T;
+   using monoid = Monoid;
+   using lazy = Lazy;
+   using aggregate_type = typename Monoid::aggregate_type;
+   using tag_type = typename Lazy::tag_type;
+   using Handle = PoolHandle<BasicPersistentTreap>;
+
+   std::atomic<std::uint32_t> link{0};
+   std::uint32_t size = 0;
+   Handle left;
+   Handle right;
+   std::uint32_t prio = 0;
+   T val = T();
 };
 
-int getSize(PersistentTreap* root) {
+// 48 байт: сумма, прибавка и приоритет
+using PersistentTreap = BasicPersistentTreap<long long>;
+using TreapPtr = PoolHandle<PersistentTreap>;
+using TreapPool = NodePool<PersistentTreap>;
+
+template <typename Node>
+inline int getSize(PoolHandle<Node> root) {
    if (!root) {
       return 0;
    }
@@ -55,206 +65,812 @@ int getSize(PersistentTreap* root) {
    return root->size;
 }
 
-long long getSum(PersistentTreap* root) {
-   if (!root) {
-      return 0;
+template <typename Node>
+inline typename Node::aggregate_type getAggregate(PoolHandle<Node> root) {
+   if constexpr (Node::monoid::enabled) {
+      if (root) {
+         return root->agg;
+      }
    }
 
-   return root->sum;
+   return Node::monoid::Identity();
 }
 
-void update(PersistentTreap* root) {
+template <typename Node>
+inline typename Node::tag_type getTag(const Node& node) {
+   if constexpr (Node::lazy::enabled) {
+      return node.tag;
+   } else {
+      return Node::lazy::Identity();
+   }
+}
+
+template <typename Node>
+inline void update(PoolHandle<Node> root) {
    if (!root) {
       return;
    }
 
-   root->val += root->add;
-
-   root->size = 1 + getSize(root->left) + getSize(root->right);
-   root->sum = root->val + getSum(root->left) + getSum(root->right);
-
-   if (root->left != nullptr) {
-      root->left->add += root->add;
-      root->sum += root->left->size * root->left->add;
-   }
-   if (root->right != nullptr) {
-      root->right->add += root->add;
-      root->sum += root->right->size * root->right->add;
+   Node& node = *root;
+   node.size = 1 + getSize(node.left) + getSize(node.right);
+   if constexpr (Node::monoid::enabled) {
+      using Monoid = typename Node::monoid;
+      node.agg = Monoid::Combine(Monoid::Combine(getAggregate(node.left), Monoid::Of(node.val)),
+                                 getAggregate(node.right));
    }
 }
 
-
-void addLink(PersistentTreap* root) {
+template <typename Node>
+inline void addLink(PoolHandle<Node> root) {
    if (!root) {
       return;
    }
 
-   root->link++;
+   root->link.fetch_add(1, std::memory_order_relaxed);
 }
 
-void DelNode(PersistentTreap* root) {
+template <typename Node>
+inline void DelNode(PoolHandle<Node> root) {
    if (!root) {
       return;
    }
 
-   root->Del();
+   if (root->link.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      DelNode(root->left);
+      DelNode(root->right);
+      NodePool<Node>::Instance().Free(root);
+   }
 }
 
-void Split(PersistentTreap* root, PersistentTreap* &L, PersistentTreap* &R, int size) {
-   if (!root) {
-      L = R = nullptr;
-      return;
+// Приоритеты: xorshift на поток вместо общего rand(), начальное состояние - хэш адреса состояния
+inline std::uint32_t HashPriority(std::uint32_t x) {
+   x ^= x >> 16;
+   x *= 0x85ebca6bu;
+   x ^= x >> 13;
+   x *= 0xc2b2ae35u;
+   x ^= x >> 16;
+   return x;
+}
+
+inline std::uint32_t ThreadRandom() {
+   thread_local std::uint32_t state = HashPriority(static_cast<std::uint32_t>(
+         reinterpret_cast<std::uintptr_t>(&state) >> 4)) | 1;
+   state ^= state << 13;
+   state ^= state >> 17;
+   state ^= state << 5;
+   return state;
+}
+
+template <typename Node = PersistentTreap>
+inline PoolHandle<Node> NewNode(const typename Node::value_type& x) {
+   PoolHandle<Node> res = NodePool<Node>::Instance().Allocate();
+   Node& node = *res;
+   node.link.store(1, std::memory_order_relaxed);
+   node.size = 1;
+   node.prio = ThreadRandom();
+   node.val = x;
+   update(res);
+
+   return res;
+}
+
+// Копия вершины для path copying: новая вершина принадлежит вызывающему, дети становятся общими
+template <typename Node>
+inline PoolHandle<Node> CopyNode(PoolHandle<Node> from) {
+   PoolHandle<Node> res = NodePool<Node>::Instance().Allocate();
+   Node& node = *res;
+   const Node& src = *from;
+   node.link.store(1, std::memory_order_relaxed);
+   node.size = src.size;
+   node.left = src.left;
+   node.right = src.right;
+   node.prio = src.prio;
+   node.val = src.val;
+   static_cast<AggregateField<typename Node::monoid>&>(node) = src;
+   static_cast<LazyField<typename Node::lazy>&>(node) = src;
+   addLink(node.left);
+   addLink(node.right);
+
+   return res;
+}
+
+template <typename Node>
+inline void ApplyTag(PoolHandle<Node> root, const typename Node::tag_type& tag) {
+   using Lazy = typename Node::lazy;
+   Node& node = *root;
+   Lazy::ApplyValue(node.val, tag);
+   if constexpr (Node::monoid::enabled) {
+      Lazy::template ApplyAggregate<typename Node::monoid>(node.agg, tag, node.size);
    }
+   if constexpr (Lazy::enabled) {
+      node.tag = Lazy::Compose(node.tag, tag);
+   }
+}
 
-   PersistentTreap* cur = new PersistentTreap(root);
-   if (getSize(cur->left) + 1 <= size) {
-      Split(cur->right, cur->right, R, size - getSize(cur->left) - 1);
-      addLink(cur->left);
-      addLink(cur->right);
-      L = cur;
-   } else {
-      Split(cur->left, L, cur->left, size);
-      addLink(cur->left);
-      addLink(cur->right);
-      R = cur;
+// Функции *Owned забирают ссылки на аргументы.
+// Вершина с link == 1 достижима только через вызывающего, поэтому меняется на месте,
+// общая вершина копируется, а ссылка на оригинал отпускается.
+template <typename Node>
+inline PoolHandle<Node> Own(PoolHandle<Node> root) {
+   if (root->link.load(std::memory_order_acquire) == 1) {
+      return root;
    }
-   update(L);
-   update(R);
+
+   PoolHandle<Node> res = CopyNode(root);
+   DelNode(root);
+   return res;
 }
 
-PersistentTreap* Merge(PersistentTreap* L, PersistentTreap* R) {
-   PersistentTreap* ptrNode = nullptr;
-   if (!L || !R) {
-      ptrNode = new PersistentTreap((!L ? R : L));
-      addLink(ptrNode->left);
-      addLink(ptrNode->right);
-      return ptrNode;
+// Проталкивание tag в детей собственной вершины: общие дети копируются
+template <typename Node>
+inline void PushOwned(PoolHandle<Node> root) {
+   if constexpr (Node::lazy::enabled) {
+      if (Node::lazy::IsIdentity(root->tag)) {
+         return;
+      }
+
+      if (root->left) {
+         root->left = Own(root->left);
+         ApplyTag(root->left, root->tag);
+      }
+      if (root->right) {
+         root->right = Own(root->right);
+         ApplyTag(root->right, root->tag);
+      }
+      root->tag = Node::lazy::Identity();
    }
+}
 
-   int l = getSize(L),  r = getSize(R), rang = rand() % (l + r);
-   if (rang > r) {
-      ptrNode = new PersistentTreap(L);
-      ptrNode->right = Merge(ptrNode->right, R);
-      addLink(ptrNode->left);
-      addLink(ptrNode->right);
-      update(ptrNode);
-      return ptrNode;
-   } else {
-      ptrNode = new PersistentTreap(R);
-      ptrNode->left = Merge(L, ptrNode->left);
-      addLink(ptrNode->left);
-      addLink(ptrNode->right);
-      update(ptrNode);
-      return ptrNode;
+// Путь спуска для пересчёта снизу вверх, буфер переиспользуется потоком
+template <typename Node>
+inline std::vector<PoolHandle<Node>>& PathBuffer() {
+   thread_local std::vector<PoolHandle<Node>> path;
+   path.clear();
+   return path;
+}
+
+template <typename Node>
+inline void UpdatePath(const std::vector<PoolHandle<Node>>& path) {
+   for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      update(*it);
    }
 }
 
-PersistentTreap* Insert(PersistentTreap* root, int index, int x) {
+// Спуск сверху вниз без рекурсии: слоты - поля, в которые подвешивается следующая вершина части
+template <typename Node>
+inline void SplitOwned(PoolHandle<Node> root, PoolHandle<Node>& L, PoolHandle<Node>& R, int size) {
+   std::vector<PoolHandle<Node>>& path = PathBuffer<Node>();
+   L = R = nullptr;
+   PoolHandle<Node>* l_slot = &L;
+   PoolHandle<Node>* r_slot = &R;
+   while (root) {
+      PoolHandle<Node> cur = Own(root);
+      PushOwned(cur);
+      path.push_back(cur);
+      if (getSize(cur->left) + 1 <= size) {
+         size -= getSize(cur->left) + 1;
+         *l_slot = cur;
+         root = cur->right;
+         cur->right = nullptr;
+         l_slot = &cur->right;
+      } else {
+         *r_slot = cur;
+         root = cur->left;
+         cur->left = nullptr;
+         r_slot = &cur->left;
+      }
+   }
+   UpdatePath(path);
+}
+
+template <typename Node>
+inline PoolHandle<Node> MergeOwned(PoolHandle<Node> L, PoolHandle<Node> R) {
+   std::vector<PoolHandle<Node>>& path = PathBuffer<Node>();
+   PoolHandle<Node> res;
+   PoolHandle<Node>* slot = &res;
+   while (L && R) {
+      if (L->prio > R->prio) {
+         L = Own(L);
+         PushOwned(L);
+         path.push_back(L);
+         *slot = L;
+         slot = &L->right;
+         L = L->right;
+      } else {
+         R = Own(R);
+         PushOwned(R);
+         path.push_back(R);
+         *slot = R;
+         slot = &R->left;
+         R = R->left;
+      }
+   }
+   *slot = L ? L : R;
+   UpdatePath(path);
+
+   return res;
+}
+
+// Все функции ниже не забирают ссылки на аргументы и возвращают вершины с собственной ссылкой.
+// Путь копируется один раз при первом касании, дальше части уже принадлежат операции.
+template <typename Node>
+inline void Split(PoolHandle<Node> root, PoolHandle<Node>& L, PoolHandle<Node>& R, int size) {
+   addLink(root);
+   SplitOwned(root, L, R, size);
+}
+
+template <typename Node>
+inline PoolHandle<Node> Merge(PoolHandle<Node> L, PoolHandle<Node> R) {
+   addLink(L);
+   addLink(R);
+   return MergeOwned(L, R);
+}
 
-   PersistentTreap* L;
-   PersistentTreap* R;
+template <typename Node>
+inline PoolHandle<Node> Insert(PoolHandle<Node> root, int index, const typename Node::value_type& x) {
+   PROFILE_SCOPE("Treap::Insert")
+
+   PoolHandle<Node> L;
+   PoolHandle<Node> R;
    Split(root, L, R, index);
-   PersistentTreap* new_ = new PersistentTreap(x);
+   return MergeOwned(MergeOwned(L, NewNode<Node>(x)), R);
+}
 
-   PersistentTreap* res = Merge(Merge(L, new_), R);
-   if (L) {
-      L->Del();
-   }
-   if (R) {
-      R->Del();
+// Новая вершина x над собственными left и right.
+// Приоритеты случайные, просеивание вниз восстанавливает порядок кучи
+template <typename Node>
+inline PoolHandle<Node> BuildJoin(PoolHandle<Node> left, const typename Node::value_type& x, PoolHandle<Node> right) {
+   PoolHandle<Node> res = NewNode<Node>(x);
+   res->left = left;
+   res->right = right;
+   update(res);
+
+   PoolHandle<Node> cur = res;
+   while (true) {
+      PoolHandle<Node> top = cur;
+      if (cur->left && cur->left->prio > top->prio) {
+         top = cur->left;
+      }
+      if (cur->right && cur->right->prio > top->prio) {
+         top = cur->right;
+      }
+      if (top == cur) {
+         break;
+      }
+      std::swap(cur->prio, top->prio);
+      cur = top;
    }
 
    return res;
 }
 
-PersistentTreap* Remove(PersistentTreap* root, int index) {
+// Идеально сбалансированное дерево из массива за O(n)
+template <typename Node = PersistentTreap>
+inline PoolHandle<Node> Build(const typename Node::value_type* values, int count) {
+   if (count <= 0) {
+      return nullptr;
+   }
+
+   int mid = count / 2;
+   PoolHandle<Node> left = Build<Node>(values, mid);
+   PoolHandle<Node> right = Build<Node>(values + mid + 1, count - mid - 1);
+   return BuildJoin(left, values[mid], right);
+}
+
+template <typename Node = PersistentTreap>
+inline PoolHandle<Node> Build(const std::vector<typename Node::value_type>& values) {
+   PROFILE_SCOPE("Treap::Build")
+
+   return Build<Node>(values.data(), values.size());
+}
 
-   PersistentTreap* L;
-   PersistentTreap* R;
+template <typename Node>
+inline PoolHandle<Node> InsertRange(PoolHandle<Node> root, int index,
+                                    const typename Node::value_type* values, int count) {
+   PROFILE_SCOPE("Treap::InsertRange")
+
+   PoolHandle<Node> L;
+   PoolHandle<Node> R;
+   Split(root, L, R, index);
+   return MergeOwned(MergeOwned(L, Build<Node>(values, count)), R);
+}
+
+template <typename Node>
+inline PoolHandle<Node> Remove(PoolHandle<Node> root, int index) {
+   PROFILE_SCOPE("Treap::Remove")
+
+   PoolHandle<Node> L;
+   PoolHandle<Node> R;
    Split(root, L, R, index + 1);
 
-   PersistentTreap *new_L, *new_R;
-   Split(L, new_L, new_R, index);
+   PoolHandle<Node> new_L, new_R;
+   SplitOwned(L, new_L, new_R, index);
+   DelNode(new_R);
+
+   return MergeOwned(new_L, R);
+}
+
+// Склейка L, k, R с вершиной k посередине: k встаёт туда, где позволяет её приоритет
+template <typename Node>
+inline PoolHandle<Node> JoinOwned(PoolHandle<Node> L, PoolHandle<Node> k, PoolHandle<Node> R) {
+   bool k_over_L = !L || L->prio <= k->prio;
+   bool k_over_R = !R || R->prio <= k->prio;
+   if (k_over_L && k_over_R) {
+      k->left = L;
+      k->right = R;
+      update(k);
+      return k;
+   }
 
-   PersistentTreap* res = Merge(new_L, R);
-   if (L) {
-      L->Del();
+   if (!k_over_L && (k_over_R || L->prio > R->prio)) {
+      L = Own(L);
+      PushOwned(L);
+      L->right = JoinOwned(L->right, k, R);
+      update(L);
+      return L;
    }
-   if (R) {
-      R->Del();
+
+   R = Own(R);
+   PushOwned(R);
+   R->left = JoinOwned(L, k, R->left);
+   update(R);
+   return R;
+}
+
+// Ключ операции пакета: вставки перед позицией index раньше удаления элемента index
+template <typename Op>
+inline long long BatchKey(const Op& op) {
+   return 2LL * op.index + (op.kind == Op::Remove ? 1 : 0);
+}
+
+// ops отсортированы по BatchKey, индексы - в исходном дереве, offset - позиция начала поддерева.
+// Поддеревья без операций возвращаются как есть и остаются общими
+template <typename Node, typename Op>
+inline PoolHandle<Node> ApplyBatchOwned(PoolHandle<Node> root, const Op* first, const Op* last, int offset) {
+   if (first == last) {
+      return root;
    }
-   if (new_L) {
-      new_L->Del();
+   if (!root) {
+      // Удаления за концом дерева ничего не делают, как и в Remove
+      std::vector<typename Node::value_type> values;
+      for (const Op* op = first; op != last; ++op) {
+         if (op->kind == Op::Insert) {
+            values.push_back(op->value);
+         }
+      }
+      return Build<Node>(values.data(), values.size());
    }
-   if (new_R) {
-      new_R->Del();
+
+   PoolHandle<Node> cur = Own(root);
+   PushOwned(cur);
+   int pos = offset + getSize(cur->left);
+   long long key = 2LL * pos + 1;
+   const Op* mid = std::partition_point(first, last, [key](const Op& op) { return BatchKey(op) < key; });
+   const Op* right = std::partition_point(mid, last, [key](const Op& op) { return BatchKey(op) <= key; });
+
+   PoolHandle<Node> L = ApplyBatchOwned(cur->left, first, mid, offset);
+   PoolHandle<Node> R = ApplyBatchOwned(cur->right, right, last, pos + 1);
+   cur->left = nullptr;
+   cur->right = nullptr;
+   if (mid != right) {
+      DelNode(cur);
+      return MergeOwned(L, R);
    }
+   return JoinOwned(L, cur, R);
+}
 
-   return res;
+// Пакет вставок и удалений за один проход: O(m log(n/m + 1)) вместо m отдельных версий
+template <typename Node, typename Op>
+inline PoolHandle<Node> ApplyBatch(PoolHandle<Node> root, const Op* ops, int count) {
+   PROFILE_SCOPE("Treap::ApplyBatch")
+
+   addLink(root);
+   return ApplyBatchOwned(root, ops, ops + count, 0);
+}
+
+// extra - операция, отложенная у предка; она применяется к копии вершины вместо отдельного Push
+template <typename Node>
+inline PoolHandle<Node> RangeAddImpl(PoolHandle<Node> root, int l, int r, const typename Node::tag_type& delta,
+                                     int offset, const typename Node::tag_type& extra) {
+   using Lazy = typename Node::lazy;
+   if (!root) {
+      return nullptr;
+   }
+
+   int size = getSize(root);
+   bool disjoint = r < offset || offset + size <= l;
+   if (disjoint && Lazy::IsIdentity(extra)) {
+      addLink(root);
+      return root;
+   }
+
+   PoolHandle<Node> cur = CopyNode(root);
+   if (disjoint) {
+      ApplyTag(cur, extra);
+      return cur;
+   }
+   if (l <= offset && offset + size - 1 <= r) {
+      ApplyTag(cur, Lazy::Compose(extra, delta));
+      return cur;
+   }
+
+   ApplyTag(cur, extra);
+   typename Node::tag_type tag = cur->tag;
+   cur->tag = Lazy::Identity();
+
+   int pos = offset + getSize(cur->left);
+   PoolHandle<Node> part = RangeAddImpl(cur->left, l, r, delta, offset, tag);
+   DelNode(cur->left);
+   cur->left = part;
+   part = RangeAddImpl(cur->right, l, r, delta, pos + 1, tag);
+   DelNode(cur->right);
+   cur->right = part;
+   if (l <= pos && pos <= r) {
+      Lazy::ApplyValue(cur->val, delta);
+   }
+   update(cur);
+
+   return cur;
 }
 
-long long GetSum(PersistentTreap* root, int l, int r) {
-   update(root);
+template <typename Node>
+inline PoolHandle<Node> RangeAdd(PoolHandle<Node> root, int l, int r, const typename Node::tag_type& delta) {
+   PROFILE_SCOPE("Treap::RangeAdd")
+   static_assert(Node::lazy::enabled, "RangeAdd needs a lazy policy");
 
-   PersistentTreap* L;
-   PersistentTreap* R;
-   Split(root, L, R, r + 1);
+   return RangeAddImpl(root, l, r, delta, 0, Node::lazy::Identity());
+}
 
-   PersistentTreap *new_L, *new_R;
-   Split(L, new_L, new_R, l);
+template <typename Node>
+inline PoolHandle<Node> RangeAddOwned(PoolHandle<Node> root, int l, int r,
+                                      const typename Node::tag_type& delta, int offset) {
+   if (!root) {
+      return nullptr;
+   }
 
-   long long res = new_R->sum;
+   int size = getSize(root);
+   if (r < offset || offset + size <= l) {
+      return root;
+   }
 
-   if (L) {
-      L->Del();
+   PoolHandle<Node> cur = Own(root);
+   if (l <= offset && offset + size - 1 <= r) {
+      ApplyTag(cur, delta);
+      return cur;
    }
-   if (R) {
-      R->Del();
+
+   PushOwned(cur);
+   int pos = offset + getSize(cur->left);
+   cur->left = RangeAddOwned(cur->left, l, r, delta, offset);
+   cur->right = RangeAddOwned(cur->right, l, r, delta, pos + 1);
+   if (l <= pos && pos <= r) {
+      Node::lazy::ApplyValue(cur->val, delta);
    }
-   if (new_L) {
-      new_L->Del();
+   update(cur);
+
+   return cur;
+}
+
+// Чтение без аллокаций: спуск сверху вниз, общие вершины не меняются.
+// pending - операции предков, ещё не применённые к текущей вершине
+template <typename Node>
+inline typename Node::value_type EffectiveValue(const Node& node, const typename Node::tag_type& pending) {
+   typename Node::value_type res = node.val;
+   Node::lazy::ApplyValue(res, pending);
+   return res;
+}
+
+template <typename Node>
+inline typename Node::aggregate_type EffectiveAggregate(PoolHandle<Node> root, const typename Node::tag_type& pending) {
+   typename Node::aggregate_type res = getAggregate(root);
+   if (root) {
+      Node::lazy::template ApplyAggregate<typename Node::monoid>(res, pending, root->size);
    }
-   if (new_R) {
-      new_R->Del();
+   return res;
+}
+
+template <typename Node>
+inline typename Node::aggregate_type PrefixSum(PoolHandle<Node> root, int count) {
+   using Monoid = typename Node::monoid;
+   using Lazy = typename Node::lazy;
+   typename Node::aggregate_type res = Monoid::Identity();
+   typename Node::tag_type pending = Lazy::Identity();
+   while (root && count > 0) {
+      const Node& node = *root;
+      int left_size = getSize(node.left);
+      typename Node::tag_type child_pending = Lazy::Compose(getTag(node), pending);
+      if (count <= left_size) {
+         root = node.left;
+      } else {
+         res = Monoid::Combine(res, EffectiveAggregate(node.left, child_pending));
+         res = Monoid::Combine(res, Monoid::Of(EffectiveValue(node, pending)));
+         count -= left_size + 1;
+         root = node.right;
+      }
+      pending = child_pending;
    }
 
    return res;
 }
 
-void Search(PersistentTreap* now_root, std::ostream& out) {
-   if (now_root->left != nullptr) {
-      Search(now_root->left, out);
+template <typename Node>
+inline typename Node::aggregate_type QueryImpl(PoolHandle<Node> root, int l, int r, int offset,
+                                               const typename Node::tag_type& pending) {
+   using Monoid = typename Node::monoid;
+   int size = getSize(root);
+   if (!root || r < offset || offset + size <= l) {
+      return Monoid::Identity();
+   }
+   if (l <= offset && offset + size - 1 <= r) {
+      return EffectiveAggregate(root, pending);
+   }
+
+   const Node& node = *root;
+   int pos = offset + getSize(node.left);
+   typename Node::tag_type child_pending = Node::lazy::Compose(getTag(node), pending);
+   typename Node::aggregate_type res = QueryImpl(node.left, l, r, offset, child_pending);
+   if (l <= pos && pos <= r) {
+      res = Monoid::Combine(res, Monoid::Of(EffectiveValue(node, pending)));
    }
+   return Monoid::Combine(res, QueryImpl(node.right, l, r, pos + 1, child_pending));
+}
 
-   out << now_root->val << " ";
+// Агрегат моноида на отрезке [l, r]; для суммы по умолчанию - сумма
+template <typename Node>
+inline typename Node::aggregate_type GetSum(PoolHandle<Node> root, int l, int r) {
+   PROFILE_SCOPE("Treap::GetSum")
 
-   if (now_root->right != nullptr) {
-      Search(now_root->right, out);
+   if (l > r) {
+      return Node::monoid::Identity();
    }
+   return QueryImpl(root, l, r, 0, Node::lazy::Identity());
 }
 
-std::ostream& PrintSegment(std::ostream& out, PersistentTreap* root, int l, int r) {
-   PersistentTreap* L;
-   PersistentTreap* R;
-   Split(root, L, R, r + 1);
+template <typename Node>
+inline typename Node::value_type GetElement(PoolHandle<Node> root, int index) {
+   typename Node::tag_type pending = Node::lazy::Identity();
+   while (root) {
+      const Node& node = *root;
+      int left_size = getSize(node.left);
+      if (index == left_size) {
+         return EffectiveValue(node, pending);
+      }
+      pending = Node::lazy::Compose(getTag(node), pending);
+      if (index < left_size) {
+         root = node.left;
+      } else {
+         index -= left_size + 1;
+         root = node.right;
+      }
+   }
 
-   PersistentTreap *new_L, *new_R;
-   Split(L, new_L, new_R, l);
+   return typename Node::value_type();
+}
 
-   Search(new_R, out);
+// Первый индекс, на котором агрегат префикса достигает target (агрегат префикса монотонен), или размер
+template <typename Node>
+inline int LowerBoundPrefixSum(PoolHandle<Node> root, const typename Node::aggregate_type& target) {
+   using Monoid = typename Node::monoid;
+   int index = 0;
+   typename Node::aggregate_type before = Monoid::Identity();
+   typename Node::tag_type pending = Node::lazy::Identity();
+   while (root) {
+      const Node& node = *root;
+      typename Node::value_type val = EffectiveValue(node, pending);
+      pending = Node::lazy::Compose(getTag(node), pending);
+      typename Node::aggregate_type left_sum = Monoid::Combine(before, EffectiveAggregate(node.left, pending));
+      typename Node::aggregate_type with_val = Monoid::Combine(left_sum, Monoid::Of(val));
+      if (left_sum >= target) {
+         root = node.left;
+      } else if (with_val >= target) {
+         return index + getSize(node.left);
+      } else {
+         before = with_val;
+         index += getSize(node.left) + 1;
+         root = node.right;
+      }
+   }
+
+   return index;
+}
 
-   if (L) {
-      L->Del();
+template <typename Node, typename Func>
+void ForEachInSegment(PoolHandle<Node> root, int l, int r, Func&& func, int offset = 0,
+                      typename Node::tag_type pending = Node::lazy::Identity()) {
+   if (!root || r < offset || offset + getSize(root) <= l) {
+      return;
    }
-   if (R) {
-      R->Del();
+
+   const Node& node = *root;
+   int pos = offset + getSize(node.left);
+   typename Node::tag_type child_pending = Node::lazy::Compose(getTag(node), pending);
+   ForEachInSegment(node.left, l, r, func, offset, child_pending);
+   if (l <= pos && pos <= r) {
+      func(EffectiveValue(node, pending));
    }
-   if (new_L) {
-      new_L->Del();
+   ForEachInSegment(node.right, l, r, func, pos + 1, child_pending);
+}
+
+template <typename Node>
+inline void Search(PoolHandle<Node> now_root, std::ostream& out,
+                   typename Node::tag_type pending = Node::lazy::Identity()) {
+   typename Node::tag_type child_pending = Node::lazy::Compose(getTag(*now_root), pending);
+   if (now_root->left) {
+      Search(now_root->left, out, child_pending);
    }
-   if (new_R) {
-      new_R->Del();
+
+   out << EffectiveValue(*now_root, pending) << " ";
+
+   if (now_root->right) {
+      Search(now_root->right, out, child_pending);
    }
+}
+
+template <typename Node>
+inline std::ostream& PrintSegment(std::ostream& out, PoolHandle<Node> root, int l, int r) {
+   PROFILE_SCOPE("Treap::PrintSegment")
+
+   ForEachInSegment(root, l, r, [&out](const typename Node::value_type& val) {
+      out << val << " ";
+   });
 
    return out;
-}
\ No newline at end of file
+}
+
+/*!
+ * Версия дерева, которую можно передавать между потоками: держит ссылку на корень,
+ * копирование добавляет ссылку, деструктор её отпускает.
+ */
+template <typename Node>
+class BasicTreapVersion {
+public:
+   using Handle = PoolHandle<Node>;
+
+   BasicTreapVersion() = default;
+
+   explicit BasicTreapVersion(Handle root)
+      : root_(root)
+   {
+      addLink(root_);
+   }
+
+   // Забирает уже принадлежащую вызывающему ссылку
+   static BasicTreapVersion Adopt(Handle root) {
+      BasicTreapVersion res;
+      res.root_ = root;
+      return res;
+   }
+
+   BasicTreapVersion(const BasicTreapVersion& second)
+      : BasicTreapVersion(second.root_)
+   {}
+
+   BasicTreapVersion(BasicTreapVersion&& second) noexcept
+      : root_(second.root_)
+   {
+      second.root_ = nullptr;
+   }
+
+   BasicTreapVersion& operator=(BasicTreapVersion second) {
+      std::swap(root_, second.root_);
+      return *this;
+   }
+
+   ~BasicTreapVersion() {
+      DelNode(root_);
+   }
+
+   Handle Root() const {
+      return root_;
+   }
+
+   int Size() const {
+      return getSize(root_);
+   }
+
+   typename Node::aggregate_type GetSum(int l, int r) const {
+      return ::GetSum(root_, l, r);
+   }
+
+   typename Node::value_type Get(int index) const {
+      return GetElement(root_, index);
+   }
+
+   int LowerBoundPrefixSum(const typename Node::aggregate_type& target) const {
+      return ::LowerBoundPrefixSum(root_, target);
+   }
+
+   std::ostream& PrintSegment(std::ostream& out, int l, int r) const {
+      return ::PrintSegment(out, root_, l, r);
+   }
+
+private:
+   Handle root_;
+};
+
+using TreapVersion = BasicTreapVersion<PersistentTreap>;
+
+/*!
+ * Транзиентная сессия: пачка изменений без промежуточных версий.
+ * Путь от корня копируется только при первом касании общей вершины, дальше вершины
+ * принадлежат сессии и меняются на месте. Freeze отдаёт обычную версию; после него
+ * сессию можно продолжать, замороженные вершины снова станут общими и будут копироваться.
+ * Сессию использует один поток.
+ */
+template <typename Node>
+class BasicTreapTransient {
+public:
+   using Handle = PoolHandle<Node>;
+
+   BasicTreapTransient() = default;
+
+   explicit BasicTreapTransient(const BasicTreapVersion<Node>& base)
+      : root_(base.Root())
+   {
+      addLink(root_);
+   }
+
+   BasicTreapTransient(const BasicTreapTransient&) = delete;
+   BasicTreapTransient& operator=(const BasicTreapTransient&) = delete;
+
+   ~BasicTreapTransient() {
+      DelNode(root_);
+   }
+
+   void Insert(int index, const typename Node::value_type& x) {
+      PROFILE_SCOPE("Treap::TransientInsert")
+
+      Handle L;
+      Handle R;
+      SplitOwned(root_, L, R, index);
+      root_ = MergeOwned(MergeOwned(L, NewNode<Node>(x)), R);
+   }
+
+   void InsertRange(int index, const typename Node::value_type* values, int count) {
+      PROFILE_SCOPE("Treap::TransientInsertRange")
+
+      Handle L;
+      Handle R;
+      SplitOwned(root_, L, R, index);
+      root_ = MergeOwned(MergeOwned(L, Build<Node>(values, count)), R);
+   }
+
+   void Remove(int index) {
+      PROFILE_SCOPE("Treap::TransientRemove")
+
+      Handle L;
+      Handle R;
+      SplitOwned(root_, L, R, index + 1);
+      Handle new_L, new_R;
+      SplitOwned(L, new_L, new_R, index);
+      DelNode(new_R);
+      root_ = MergeOwned(new_L, R);
+   }
+
+   void RangeAdd(int l, int r, const typename Node::tag_type& delta) {
+      PROFILE_SCOPE("Treap::TransientRangeAdd")
+
+      root_ = RangeAddOwned(root_, l, r, delta, 0);
+   }
+
+   int Size() const {
+      return getSize(root_);
+   }
+
+   typename Node::aggregate_type GetSum(int l, int r) const {
+      return ::GetSum(root_, l, r);
+   }
+
+   typename Node::value_type Get(int index) const {
+      return GetElement(root_, index);
+   }
+
+   BasicTreapVersion<Node> Freeze() const {
+      return BasicTreapVersion<Node>(root_);
+   }
+
+private:
+   Handle root_;
+};
+
+using TreapTransient = BasicTreapTransient<PersistentTreap>;
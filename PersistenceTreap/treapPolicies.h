@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+/*!
+ * Моноиды агрегата для BasicPersistentTreap: Identity, Of(значение), Combine(левый, правый).
+ * AddToAll(агрегат, прибавка, размер) нужен только вместе с AddLazy.
+ * enabled == false - агрегат не хранится в вершине.
+ */
+template <typename T>
+struct SumMonoid {
+   using aggregate_type = T;
+   static constexpr bool enabled = true;
+
+   static T Identity() { return T(); }
+   static T Of(const T& val) { return val; }
+   static T Combine(const T& left, const T& right) { return left + right; }
+   static T AddToAll(const T& agg, const T& delta, int size) { return agg + delta * size; }
+};
+
+template <typename T>
+struct MinMonoid {
+   using aggregate_type = T;
+   static constexpr bool enabled = true;
+
+   static T Identity() { return std::numeric_limits<T>::max(); }
+   static T Of(const T& val) { return val; }
+   static T Combine(const T& left, const T& right) { return std::min(left, right); }
+   static T AddToAll(const T& agg, const T& delta, int) { return agg + delta; }
+};
+
+template <typename T>
+struct MaxMonoid {
+   using aggregate_type = T;
+   static constexpr bool enabled = true;
+
+   static T Identity() { return std::numeric_limits<T>::lowest(); }
+   static T Of(const T& val) { return val; }
+   static T Combine(const T& left, const T& right) { return std::max(left, right); }
+   static T AddToAll(const T& agg, const T& delta, int) { return agg + delta; }
+};
+
+struct NoAggregate {
+   struct aggregate_type {};
+   static constexpr bool enabled = false;
+
+   static aggregate_type Identity() { return {}; }
+   template <typename T>
+   static aggregate_type Of(const T&) { return {}; }
+   static aggregate_type Combine(aggregate_type, aggregate_type) { return {}; }
+};
+
+/*!
+ * Отложенные операции: тег копится в вершине и относится к детям, значение и агрегат
+ * самой вершины уже его учитывают. Compose(старый, новый) - тег, равный применению обоих.
+ */
+template <typename T>
+struct AddLazy {
+   using tag_type = T;
+   static constexpr bool enabled = true;
+
+   static T Identity() { return T(); }
+   static bool IsIdentity(const T& tag) { return tag == T(); }
+   static T Compose(const T& older, const T& newer) { return older + newer; }
+   static void ApplyValue(T& val, const T& tag) { val += tag; }
+
+   template <typename Monoid>
+   static void ApplyAggregate(typename Monoid::aggregate_type& agg, const T& tag, int size) {
+      agg = Monoid::AddToAll(agg, tag, size);
+   }
+};
+
+struct NoLazy {
+   struct tag_type {};
+   static constexpr bool enabled = false;
+
+   static tag_type Identity() { return {}; }
+   static bool IsIdentity(tag_type) { return true; }
+   static tag_type Compose(tag_type, tag_type) { return {}; }
+   template <typename T>
+   static void ApplyValue(T&, tag_type) {}
+
+   template <typename Monoid>
+   static void ApplyAggregate(typename Monoid::aggregate_type&, tag_type, int) {}
+};
+
+#ifndef TREAP_TREAPPOLICIES_H
+#define TREAP_TREAPPOLICIES_H
+
+#endif //TREAP_TREAPPOLICIES_H
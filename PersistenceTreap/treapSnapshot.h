@@ -0,0 +1,521 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "PersistentTreapHeap.h"
+
+/*!
+ * Бинарный снимок истории PTHeap: каждая вершина пишется один раз, общие поддеревья версий не дублируются.
+ * Формат (байты в порядке машины):
+ *   SnapshotHeader
+ *   node_count записей SnapshotRecord - в обратном порядке обхода, дети раньше родителей
+ *   version_count записей SnapshotVersion
+ * Ссылки на вершины - номера записей с 1, 0 - пустая ссылка.
+ * Записи фиксированного размера, поэтому файл можно загрузить за один проход (ReadSnapshot)
+ * или отобразить в память и читать версии без загрузки (MappedSnapshot).
+ */
+struct SnapshotHeader {
+   char magic[8];
+   std::uint32_t format;
+   std::uint32_t record_size;
+   std::uint64_t node_count;
+   std::uint32_t version_count;
+   std::int32_t head;
+};
+
+constexpr char kSnapshotMagic[8] = "PTHSNAP";
+constexpr std::uint32_t kSnapshotFormat = 1;
+
+struct SnapshotVersion {
+   std::uint32_t root;
+   std::int32_t parent;
+   std::uint32_t alive;
+};
+
+// Вершина без ссылок на пул: агрегат и тег - те же пустые при выключенной политике базы, что и у вершины
+template <typename Node>
+struct SnapshotRecord : AggregateField<typename Node::monoid>, LazyField<typename Node::lazy> {
+   std::uint32_t left;
+   std::uint32_t right;
+   std::uint32_t size;
+   std::uint32_t prio;
+   typename Node::value_type val;
+};
+
+template <typename Node>
+inline typename Node::aggregate_type getAggregate(const SnapshotRecord<Node>* records, std::uint32_t index) {
+   if constexpr (Node::monoid::enabled) {
+      if (index) {
+         return records[index - 1].agg;
+      }
+   }
+
+   return Node::monoid::Identity();
+}
+
+template <typename Node>
+inline typename Node::tag_type getTag(const SnapshotRecord<Node>& record) {
+   if constexpr (Node::lazy::enabled) {
+      return record.tag;
+   } else {
+      return Node::lazy::Identity();
+   }
+}
+
+template <typename Node>
+void WriteSnapshot(std::ostream& out, const BasicPTHeap<Node>& heap) {
+   PROFILE_SCOPE("Treap::WriteSnapshot")
+
+   using Record = SnapshotRecord<Node>;
+   using Handle = PoolHandle<Node>;
+   static_assert(std::is_trivially_copyable<Record>::value, "snapshot record must be trivially copyable");
+   static_assert(sizeof(SnapshotHeader) % alignof(Record) == 0, "records must stay aligned in the file");
+
+   // Версии держат корни, поэтому вершины не меняются, пока пишем, и писатели кучи не ждут
+   VersionId head = -1;
+   auto entries = heap.ExportVersions(&head);
+
+   // Номер записи по id вершины в пуле; порядок - дети раньше родителей
+   std::vector<std::uint32_t> index;
+   std::vector<Handle> order;
+   std::vector<std::pair<Handle, bool>> stack;
+   auto number = [&index](Handle node) -> std::uint32_t& {
+      if (node.id >= index.size()) {
+         index.resize(std::max<size_t>(node.id + 1, index.size() * 2), 0);
+      }
+      return index[node.id];
+   };
+
+   for (auto& entry : entries) {
+      Handle root = entry.version.Root();
+      if (!root || number(root)) {
+         continue;
+      }
+      stack.emplace_back(root, false);
+      while (!stack.empty()) {
+         auto [node, expanded] = stack.back();
+         stack.pop_back();
+         if (expanded) {
+            order.push_back(node);
+            number(node) = order.size();
+            continue;
+         }
+         stack.emplace_back(node, true);
+         if (node->right && !number(node->right)) {
+            stack.emplace_back(node->right, false);
+         }
+         if (node->left && !number(node->left)) {
+            stack.emplace_back(node->left, false);
+         }
+      }
+   }
+
+   SnapshotHeader header{};
+   std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+   header.format = kSnapshotFormat;
+   header.record_size = sizeof(Record);
+   header.node_count = order.size();
+   header.version_count = entries.size();
+   header.head = head;
+   out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+   // Пишем пачками, чтобы поток не дёргался на каждую вершину
+   constexpr size_t kChunk = 4096;
+   std::vector<Record> chunk;
+   chunk.reserve(kChunk);
+   for (Handle handle : order) {
+      const Node& node = *handle;
+      Record record{};
+      record.left = node.left ? number(node.left) : 0;
+      record.right = node.right ? number(node.right) : 0;
+      record.size = node.size;
+      record.prio = node.prio;
+      record.val = node.val;
+      if constexpr (Node::monoid::enabled) {
+         record.agg = node.agg;
+      }
+      if constexpr (Node::lazy::enabled) {
+         record.tag = node.tag;
+      }
+      chunk.push_back(record);
+      if (chunk.size() == kChunk) {
+         out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size() * sizeof(Record));
+         chunk.clear();
+      }
+   }
+   out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size() * sizeof(Record));
+
+   std::vector<SnapshotVersion> table;
+   table.reserve(entries.size());
+   for (auto& entry : entries) {
+      Handle root = entry.version.Root();
+      table.push_back(SnapshotVersion{root ? number(root) : 0, entry.parent, entry.alive});
+   }
+   out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(SnapshotVersion));
+
+   if (!out) {
+      throw PTHeapException("snapshot write failed");
+   }
+}
+
+template <typename Node>
+inline void CheckSnapshotHeader(const SnapshotHeader& header) {
+   if (std::memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 || header.format != kSnapshotFormat) {
+      throw PTHeapException("not a treap snapshot");
+   }
+   if (header.record_size != sizeof(SnapshotRecord<Node>)) {
+      throw PTHeapException("snapshot was written for another node type");
+   }
+   // Номера записей 32-битные, больше вершин в файле быть не может
+   if (header.node_count > UINT32_MAX) {
+      throw PTHeapException("snapshot node count is out of range");
+   }
+   if (header.head < 0 || static_cast<std::uint32_t>(header.head) >= header.version_count) {
+      throw PTHeapException("snapshot head version does not exist");
+   }
+}
+
+// Загрузка за один проход: дети записаны раньше родителей, поэтому ссылки уже известны
+template <typename Node>
+void ReadSnapshot(std::istream& in, BasicPTHeap<Node>& heap) {
+   PROFILE_SCOPE("Treap::ReadSnapshot")
+
+   using Record = SnapshotRecord<Node>;
+   using Handle = PoolHandle<Node>;
+
+   SnapshotHeader header;
+   if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+      throw PTHeapException("snapshot is truncated");
+   }
+   CheckSnapshotHeader<Node>(header);
+
+   std::vector<Handle> nodes;
+   nodes.reserve(header.node_count);
+   // Отпускает вершины, на которые никто не ссылается (при ошибке - корни загруженных поддеревьев),
+   // дети освобождаются вместе с ними. Корни собираются заранее: освобождение меняет link детей
+   auto release_loaded = [&nodes]() {
+      std::vector<Handle> roots;
+      for (Handle node : nodes) {
+         if (node->link.load(std::memory_order_relaxed) == 0) {
+            roots.push_back(node);
+         }
+      }
+      for (Handle root : roots) {
+         addLink(root);
+         DelNode(root);
+      }
+   };
+   auto child = [&](std::uint32_t number) -> Handle {
+      if (number > nodes.size()) {
+         release_loaded();
+         throw PTHeapException("snapshot node refers to a later node");
+      }
+      return number ? nodes[number - 1] : Handle();
+   };
+
+   constexpr size_t kChunk = 4096;
+   std::vector<Record> chunk(kChunk);
+   for (std::uint64_t done = 0; done < header.node_count;) {
+      size_t count = std::min<std::uint64_t>(kChunk, header.node_count - done);
+      if (!in.read(reinterpret_cast<char*>(chunk.data()), count * sizeof(Record))) {
+         release_loaded();
+         throw PTHeapException("snapshot is truncated");
+      }
+      for (size_t i = 0; i < count; ++i) {
+         const Record& record = chunk[i];
+         // Ссылки проверяются до выделения: при ошибке новая вершина не успевает появиться
+         Handle left = child(record.left);
+         Handle right = child(record.right);
+         if (record.size != static_cast<std::uint64_t>(getSize(left)) + getSize(right) + 1) {
+            release_loaded();
+            throw PTHeapException("snapshot node size does not match its children");
+         }
+         Handle res = NodePool<Node>::Instance().Allocate();
+         Node& node = *res;
+         node.left = left;
+         node.right = right;
+         addLink(node.left);
+         addLink(node.right);
+         node.size = record.size;
+         node.prio = record.prio;
+         node.val = record.val;
+         if constexpr (Node::monoid::enabled) {
+            node.agg = record.agg;
+         }
+         if constexpr (Node::lazy::enabled) {
+            node.tag = record.tag;
+         }
+         nodes.push_back(res);
+      }
+      done += count;
+   }
+
+   std::vector<SnapshotVersion> table(header.version_count);
+   if (!in.read(reinterpret_cast<char*>(table.data()), table.size() * sizeof(SnapshotVersion))) {
+      release_loaded();
+      throw PTHeapException("snapshot is truncated");
+   }
+
+   std::vector<typename BasicPTHeap<Node>::VersionEntry> entries;
+   entries.reserve(table.size());
+   for (auto& version : table) {
+      if (version.parent < -1 || version.parent >= static_cast<std::int64_t>(table.size())) {
+         release_loaded();
+         throw PTHeapException("snapshot version parent does not exist");
+      }
+      entries.push_back({BasicTreapVersion<Node>(child(version.root)), version.parent, version.alive != 0});
+   }
+   release_loaded();
+   heap.Restore(entries, header.head);
+}
+
+template <typename Node>
+void SaveSnapshot(const std::string& path, const BasicPTHeap<Node>& heap) {
+   std::ofstream out(path, std::ios_base::binary);
+   if (!out) {
+      throw PTHeapException("cant open snapshot file " + path);
+   }
+   WriteSnapshot(out, heap);
+}
+
+template <typename Node>
+void LoadSnapshot(const std::string& path, BasicPTHeap<Node>& heap) {
+   std::ifstream in(path, std::ios_base::binary);
+   if (!in) {
+      throw PTHeapException("cant open snapshot file " + path);
+   }
+   ReadSnapshot(in, heap);
+}
+
+/*!
+ * Снимок, отображённый в память только для чтения: версии читаются прямо из файла,
+ * в пул ничего не загружается. Страницы подгружает ОС, поэтому открытие не зависит от размера истории.
+ */
+template <typename Node>
+class MappedSnapshot {
+public:
+   using Record = SnapshotRecord<Node>;
+
+   // Версия внутри снимка: те же запросы, что у BasicTreapVersion
+   class View {
+   public:
+      View(const Record* records, std::uint32_t root)
+         : records_(records)
+         , root_(root)
+      {}
+
+      int Size() const {
+         return getSize(root_);
+      }
+
+      typename Node::value_type Get(int index) const {
+         typename Node::tag_type pending = Node::lazy::Identity();
+         std::uint32_t cur = root_;
+         while (cur) {
+            const Record& record = At(cur);
+            int left_size = getSize(record.left);
+            if (index == left_size) {
+               return Effective(record, pending);
+            }
+            pending = Node::lazy::Compose(getTag(record), pending);
+            if (index < left_size) {
+               cur = record.left;
+            } else {
+               index -= left_size + 1;
+               cur = record.right;
+            }
+         }
+
+         return typename Node::value_type();
+      }
+
+      typename Node::aggregate_type GetSum(int l, int r) const {
+         if (l > r) {
+            return Node::monoid::Identity();
+         }
+         return Query(root_, l, r, 0, Node::lazy::Identity());
+      }
+
+      std::ostream& PrintSegment(std::ostream& out, int l, int r) const {
+         Print(out, root_, l, r, 0, Node::lazy::Identity());
+         return out;
+      }
+
+   private:
+      const Record* records_;
+      std::uint32_t root_;
+
+      int getSize(std::uint32_t index) const {
+         return index ? records_[index - 1].size : 0;
+      }
+
+      // Номер cur уже проверен (корень - при открытии, ребёнок - у родителя). Дети записаны раньше родителя,
+      // поэтому номер ребёнка меньше; иначе файл испорчен и ссылка может вести за его конец
+      const Record& At(std::uint32_t cur) const {
+         const Record& record = records_[cur - 1];
+         if (record.left >= cur || record.right >= cur) {
+            throw PTHeapException("snapshot node refers to a later node");
+         }
+         if (record.size != static_cast<std::uint64_t>(getSize(record.left)) + getSize(record.right) + 1) {
+            throw PTHeapException("snapshot node size does not match its children");
+         }
+         return record;
+      }
+
+      static typename Node::value_type Effective(const Record& record, const typename Node::tag_type& pending) {
+         typename Node::value_type res = record.val;
+         Node::lazy::ApplyValue(res, pending);
+         return res;
+      }
+
+      typename Node::aggregate_type Query(std::uint32_t cur, int l, int r, int offset,
+                                          const typename Node::tag_type& pending) const {
+         using Monoid = typename Node::monoid;
+         int size = getSize(cur);
+         if (!cur || r < offset || offset + size <= l) {
+            return Monoid::Identity();
+         }
+         if (l <= offset && offset + size - 1 <= r) {
+            typename Node::aggregate_type res = ::getAggregate<Node>(records_, cur);
+            Node::lazy::template ApplyAggregate<Monoid>(res, pending, size);
+            return res;
+         }
+
+         const Record& record = At(cur);
+         int pos = offset + getSize(record.left);
+         typename Node::tag_type child_pending = Node::lazy::Compose(getTag(record), pending);
+         typename Node::aggregate_type res = Query(record.left, l, r, offset, child_pending);
+         if (l <= pos && pos <= r) {
+            res = Monoid::Combine(res, Monoid::Of(Effective(record, pending)));
+         }
+         return Monoid::Combine(res, Query(record.right, l, r, pos + 1, child_pending));
+      }
+
+      void Print(std::ostream& out, std::uint32_t cur, int l, int r, int offset,
+                 const typename Node::tag_type& pending) const {
+         if (!cur || r < offset || offset + getSize(cur) <= l) {
+            return;
+         }
+
+         const Record& record = At(cur);
+         int pos = offset + getSize(record.left);
+         typename Node::tag_type child_pending = Node::lazy::Compose(getTag(record), pending);
+         Print(out, record.left, l, r, offset, child_pending);
+         if (l <= pos && pos <= r) {
+            out << Effective(record, pending) << " ";
+         }
+         Print(out, record.right, l, r, pos + 1, child_pending);
+      }
+   };
+
+   explicit MappedSnapshot(const std::string& path) {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) {
+         throw PTHeapException("cant open snapshot file " + path);
+      }
+      struct stat info;
+      if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SnapshotHeader)) {
+         close(fd);
+         throw PTHeapException("snapshot is truncated");
+      }
+      length = info.st_size;
+      void* data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (data == MAP_FAILED) {
+         throw PTHeapException("cant map snapshot file " + path);
+      }
+      base = static_cast<const char*>(data);
+
+      std::memcpy(&header, base, sizeof(header));
+      try {
+         CheckSnapshotHeader<Node>(header);
+         if (header.node_count > length / sizeof(Record)
+             || length < sizeof(SnapshotHeader) + header.node_count * sizeof(Record)
+                         + header.version_count * sizeof(SnapshotVersion)) {
+            throw PTHeapException("snapshot is truncated");
+         }
+         records = reinterpret_cast<const Record*>(base + sizeof(SnapshotHeader));
+         table = reinterpret_cast<const SnapshotVersion*>(base + sizeof(SnapshotHeader)
+                                                          + header.node_count * sizeof(Record));
+         CheckTable();
+      } catch (...) {
+         munmap(const_cast<char*>(base), length);
+         throw;
+      }
+   }
+
+   MappedSnapshot(const MappedSnapshot&) = delete;
+   MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+   ~MappedSnapshot() {
+      munmap(const_cast<char*>(base), length);
+   }
+
+   int VersionCount() const {
+      return header.version_count;
+   }
+
+   VersionId Head() const {
+      return header.head;
+   }
+
+   bool IsAlive(VersionId id) const {
+      return 0 <= id && id < VersionCount() && table[id].alive;
+   }
+
+   VersionId Parent(VersionId id) const {
+      CheckVersion(id);
+      return table[id].parent;
+   }
+
+   View GetVersion(VersionId id) const {
+      CheckVersion(id);
+      return View(records, table[id].root);
+   }
+
+   size_t NodeCount() const {
+      return header.node_count;
+   }
+
+private:
+   const char* base = nullptr;
+   size_t length = 0;
+   SnapshotHeader header;
+   const Record* records = nullptr;
+   const SnapshotVersion* table = nullptr;
+
+   // Таблица версий проверяется целиком при открытии, записи вершин - по пути обхода (см. View::At)
+   void CheckTable() const {
+      for (std::uint32_t i = 0; i < header.version_count; ++i) {
+         if (table[i].root > header.node_count) {
+            throw PTHeapException("snapshot version root does not exist");
+         }
+         if (table[i].parent < -1 || table[i].parent >= static_cast<std::int64_t>(header.version_count)) {
+            throw PTHeapException("snapshot version parent does not exist");
+         }
+      }
+   }
+
+   void CheckVersion(VersionId id) const {
+      if (!IsAlive(id)) {
+         throw PTHeapException("version " + std::to_string(id) + " does not exist");
+      }
+   }
+};
+
+#ifndef TREAP_TREAPSNAPSHOT_H
+#define TREAP_TREAPSNAPSHOT_H
+
+#endif //TREAP_TREAPSNAPSHOT_H
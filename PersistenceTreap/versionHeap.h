@@ -0,0 +1,416 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class PTHeapException {
+public:
+   PTHeapException(const std::string& error_m)
+      : message(error_m)
+   {}
+
+   std::string GetError() { return message; }
+
+private:
+   std::string message{""};
+};
+
+using VersionId = int;
+
+// Операция пакета ApplyBatch: индексы относятся к исходной версии, поэтому порядок операций не важен,
+// кроме вставок в одну позицию - они идут в порядке пакета
+template <typename T>
+struct BatchOp {
+   enum Kind { Insert, Remove };
+
+   Kind kind;
+   int index;
+   T value;
+
+   static BatchOp MakeInsert(int index, const T& value) {
+      return BatchOp{Insert, index, value};
+   }
+
+   static BatchOp MakeRemove(int index) {
+      return BatchOp{Remove, index, T()};
+   }
+};
+
+/*!
+ * Память графа версий. live_* и reserved_bytes - по всему пулу вершин (общему для всех куч этого типа),
+ * reachable_* - вершины, достижимые из живых версий кучи, shared_* - те из них, что достижимы
+ * больше чем из одной версии.
+ */
+struct MemoryStats {
+   size_t versions = 0;
+   size_t live_nodes = 0;
+   size_t live_bytes = 0;
+   size_t reserved_bytes = 0;
+   size_t reachable_nodes = 0;
+   size_t reachable_bytes = 0;
+   size_t shared_nodes = 0;
+   size_t shared_bytes = 0;
+
+   void WriteJson(std::ostream& out) const {
+      out << "{\"versions\":" << versions
+          << ",\"live_nodes\":" << live_nodes
+          << ",\"live_bytes\":" << live_bytes
+          << ",\"reserved_bytes\":" << reserved_bytes
+          << ",\"reachable_nodes\":" << reachable_nodes
+          << ",\"reachable_bytes\":" << reachable_bytes
+          << ",\"shared_nodes\":" << shared_nodes
+          << ",\"shared_bytes\":" << shared_bytes << "}";
+   }
+};
+
+/*!
+ * Граф версий над персистентной структурой, операции которой собраны в Ops
+ * (Handle, Version, Transient, Build, Insert, InsertRange, Remove, RangeAdd, ApplyBatch, AddRef, Release;
+ * для GetMemoryStats - NodeKey, NodeBytes, ForEachChild, LiveNodes, LiveBytes, BytesReserved;
+ * для ConcatVersions и SplitVersion - Concat, SplitMany).
+ * Каждая версия знает родителя, от любой версии можно строить новую (ветку).
+ * Старый стековый интерфейс работает с головой - последней созданной или выбранной Checkout версией.
+ * Изменения идут под мьютексом, чтение - по снимку Version, который не мешает писателю.
+ */
+template <typename Ops>
+class BasicVersionHeap {
+public:
+   using Handle = typename Ops::Handle;
+   using Version = typename Ops::Version;
+   using value_type = typename Ops::value_type;
+   using aggregate_type = typename Ops::aggregate_type;
+   using tag_type = typename Ops::tag_type;
+   using Op = BatchOp<value_type>;
+
+   // Версия вместе с местом в графе; для снимков (treapSnapshot.h)
+   struct VersionEntry {
+      Version version;
+      VersionId parent;
+      bool alive;
+   };
+
+   BasicVersionHeap() {
+      head = AddVersion(nullptr, -1);
+   }
+
+   BasicVersionHeap(Handle first) {
+      Ops::AddRef(first);
+      head = AddVersion(first, -1);
+   }
+
+   explicit BasicVersionHeap(const std::vector<value_type>& values) {
+      head = AddVersion(Ops::Build(values), -1);
+   }
+
+   BasicVersionHeap(const BasicVersionHeap&) = delete;
+   BasicVersionHeap& operator=(const BasicVersionHeap&) = delete;
+
+   ~BasicVersionHeap() {
+      for (auto& version : versions) {
+         Ops::Release(version.root);
+      }
+   }
+
+   VersionId InsertToVersion(VersionId base, int index, const value_type& val) {
+      std::lock_guard<std::mutex> locker(m_);
+      return AddVersion(Ops::Insert(RootOf(base), index, val), base);
+   }
+
+   VersionId InsertRangeToVersion(VersionId base, int index, const std::vector<value_type>& values) {
+      std::lock_guard<std::mutex> locker(m_);
+      return AddVersion(Ops::InsertRange(RootOf(base), index, values.data(), values.size()), base);
+   }
+
+   VersionId RemoveFromVersion(VersionId base, int index) {
+      std::lock_guard<std::mutex> locker(m_);
+      return AddVersion(Ops::Remove(RootOf(base), index), base);
+   }
+
+   VersionId RangeAddToVersion(VersionId base, int l, int r, const tag_type& delta) {
+      std::lock_guard<std::mutex> locker(m_);
+      return AddVersion(Ops::RangeAdd(RootOf(base), l, r, delta), base);
+   }
+
+   // Пачка изменений через сессию Ops::Transient даёт одну новую версию: edit(Transient&)
+   template <typename Func>
+   VersionId EditVersion(VersionId base, Func&& edit) {
+      std::lock_guard<std::mutex> locker(m_);
+      return AddVersion(EditImpl(RootOf(base), edit), base);
+   }
+
+   template <typename Func>
+   void EditTreap(Func&& edit) {
+      std::lock_guard<std::mutex> locker(m_);
+      head = AddVersion(EditImpl(RootOf(head), edit), head);
+   }
+
+   // Все операции пакета дают одну новую версию
+   VersionId ApplyBatchToVersion(VersionId base, std::vector<Op> ops) {
+      SortBatch(ops);
+      std::lock_guard<std::mutex> locker(m_);
+      return AddVersion(Ops::ApplyBatch(RootOf(base), ops.data(), ops.size()), base);
+   }
+
+   void ApplyBatch(std::vector<Op> ops) {
+      SortBatch(ops);
+      std::lock_guard<std::mutex> locker(m_);
+      head = AddVersion(Ops::ApplyBatch(RootOf(head), ops.data(), ops.size()), head);
+   }
+
+   // Склейка версий по порядку в одну новую, её родитель - первая из них
+   VersionId ConcatVersions(const std::vector<VersionId>& ids) {
+      std::lock_guard<std::mutex> locker(m_);
+      std::vector<Handle> parts;
+      parts.reserve(ids.size());
+      for (VersionId id : ids) {
+         parts.push_back(RootOf(id));
+      }
+      return AddVersion(Ops::Concat(parts), ids.empty() ? -1 : ids.front());
+   }
+
+   // Разрезает base по неубывающим позициям cuts: cuts.size() + 1 новых версий с родителем base
+   std::vector<VersionId> SplitVersion(VersionId base, const std::vector<int>& cuts) {
+      std::lock_guard<std::mutex> locker(m_);
+      std::vector<VersionId> res;
+      for (Handle part : Ops::SplitMany(RootOf(base), cuts)) {
+         res.push_back(AddVersion(part, base));
+      }
+      return res;
+   }
+
+   // Новая ветка: версия с тем же деревом, что и base
+   VersionId Fork(VersionId base) {
+      std::lock_guard<std::mutex> locker(m_);
+      Handle root = RootOf(base);
+      Ops::AddRef(root);
+      return AddVersion(root, base);
+   }
+
+   Version GetVersion(VersionId id) const {
+      std::lock_guard<std::mutex> locker(m_);
+      return Version(RootOf(id));
+   }
+
+   VersionId Parent(VersionId id) const {
+      std::lock_guard<std::mutex> locker(m_);
+      RootOf(id);
+      return versions[id].parent;
+   }
+
+   // Версия перестаёт быть доступной, вершины освобождаются, если их не держат другие версии
+   void ReleaseVersion(VersionId id) {
+      std::lock_guard<std::mutex> locker(m_);
+      Release(id);
+   }
+
+   bool IsAlive(VersionId id) const {
+      std::lock_guard<std::mutex> locker(m_);
+      return 0 <= id && id < static_cast<VersionId>(versions.size()) && versions[id].alive;
+   }
+
+   void Checkout(VersionId id) {
+      std::lock_guard<std::mutex> locker(m_);
+      RootOf(id);
+      head = id;
+   }
+
+   VersionId CurrentVersion() const {
+      std::lock_guard<std::mutex> locker(m_);
+      return head;
+   }
+
+   void InsertToTreap(int index, const value_type& val) {
+      std::lock_guard<std::mutex> locker(m_);
+      head = AddVersion(Ops::Insert(RootOf(head), index, val), head);
+   }
+
+   void InsertRangeToTreap(int index, const std::vector<value_type>& values) {
+      std::lock_guard<std::mutex> locker(m_);
+      head = AddVersion(Ops::InsertRange(RootOf(head), index, values.data(), values.size()), head);
+   }
+
+   void RemoveFromTreap(int index) {
+      std::lock_guard<std::mutex> locker(m_);
+      head = AddVersion(Ops::Remove(RootOf(head), index), head);
+   }
+
+   void RangeAddToTreap(int l, int r, const tag_type& delta) {
+      std::lock_guard<std::mutex> locker(m_);
+      head = AddVersion(Ops::RangeAdd(RootOf(head), l, r, delta), head);
+   }
+
+   Version Current() const {
+      std::lock_guard<std::mutex> locker(m_);
+      return Version(RootOf(head));
+   }
+
+   aggregate_type GetSumFromTreap(int l, int r) const {
+      return Current().GetSum(l, r);
+   }
+
+   value_type GetFromTreap(int index) const {
+      return Current().Get(index);
+   }
+
+   int LowerBoundPrefixSumInTreap(const aggregate_type& target) const {
+      return Current().LowerBoundPrefixSum(target);
+   }
+
+   std::ostream& PrintTreapSegment(std::ostream& out, int l, int r) const {
+      return Current().PrintSegment(out, l, r);
+   }
+
+   long long GetSize() const {
+       return Current().Size();
+   }
+
+   // Ссылки на корни всех версий: пока они живы, вершины не меняются и их можно читать без блокировки
+   std::vector<VersionEntry> ExportVersions(VersionId* head_id = nullptr) const {
+      std::lock_guard<std::mutex> locker(m_);
+      std::vector<VersionEntry> res;
+      res.reserve(versions.size());
+      for (auto& version : versions) {
+         res.push_back(VersionEntry{Version(version.root), version.parent, version.alive});
+      }
+      if (head_id) {
+         *head_id = head;
+      }
+      return res;
+   }
+
+   // Заменяет весь граф версий, старые версии отпускаются
+   void Restore(const std::vector<VersionEntry>& entries, VersionId head_id) {
+      std::vector<VersionInfo> restored;
+      restored.reserve(entries.size());
+      for (auto& entry : entries) {
+         Handle root = entry.alive ? entry.version.Root() : Handle();
+         Ops::AddRef(root);
+         restored.push_back(VersionInfo{root, entry.parent, entry.alive});
+      }
+
+      std::lock_guard<std::mutex> locker(m_);
+      std::swap(versions, restored);
+      head = head_id;
+      for (auto& version : restored) {
+         Ops::Release(version.root);
+      }
+   }
+
+   // Обходит все живые версии, каждую вершину - один раз (плюс повторный заход, если она общая)
+   MemoryStats GetMemoryStats() const {
+      std::lock_guard<std::mutex> locker(m_);
+      MemoryStats stats;
+      stats.live_nodes = Ops::LiveNodes();
+      stats.live_bytes = Ops::LiveBytes();
+      stats.reserved_bytes = Ops::BytesReserved();
+
+      struct Mark {
+         VersionId version;
+         bool shared;
+      };
+      std::unordered_map<std::uint64_t, Mark> marks;
+      std::vector<Handle> stack;
+
+      for (VersionId id = 0; id < static_cast<VersionId>(versions.size()); ++id) {
+         if (!versions[id].alive) {
+            continue;
+         }
+         ++stats.versions;
+         if (versions[id].root) {
+            stack.push_back(versions[id].root);
+         }
+
+         while (!stack.empty()) {
+            Handle node = stack.back();
+            stack.pop_back();
+
+            auto it = marks.find(Ops::NodeKey(node));
+            if (it == marks.end()) {
+               marks.emplace(Ops::NodeKey(node), Mark{id, false});
+               ++stats.reachable_nodes;
+               stats.reachable_bytes += Ops::NodeBytes(node);
+            } else if (it->second.version == id || it->second.shared) {
+               // Поддерево общей вершины уже помечено целиком
+               continue;
+            } else {
+               it->second.shared = true;
+               ++stats.shared_nodes;
+               stats.shared_bytes += Ops::NodeBytes(node);
+            }
+            Ops::ForEachChild(node, [&stack](Handle child) { stack.push_back(child); });
+         }
+      }
+      return stats;
+   }
+
+   // Отменяет последние операции ветки: голова удаляется и переходит к родителю
+   void CancelOperations(int count) {
+      std::lock_guard<std::mutex> locker(m_);
+      for (int i = 0; i < count; ++i) {
+         RootOf(head);
+         VersionId parent = versions[head].parent;
+         Release(head);
+         head = parent;
+      }
+   }
+
+private:
+   struct VersionInfo {
+      Handle root;
+      VersionId parent;
+      bool alive;
+   };
+
+   mutable std::mutex m_;
+   std::vector<VersionInfo> versions;
+   VersionId head = -1;
+
+   VersionId AddVersion(Handle root, VersionId parent) {
+      versions.push_back(VersionInfo{root, parent, true});
+      return versions.size() - 1;
+   }
+
+   Handle RootOf(VersionId id) const {
+      if (id < 0 || id >= static_cast<VersionId>(versions.size()) || !versions[id].alive) {
+         throw PTHeapException("version " + std::to_string(id) + " does not exist");
+      }
+      return versions[id].root;
+   }
+
+   // Вставки в одну позицию - перед удалением элемента с этим индексом, порядок вставок сохраняется
+   static void SortBatch(std::vector<Op>& ops) {
+      std::stable_sort(ops.begin(), ops.end(), [](const Op& first, const Op& second) {
+         if (first.index != second.index) {
+            return first.index < second.index;
+         }
+         return first.kind == Op::Insert && second.kind == Op::Remove;
+      });
+   }
+
+   template <typename Func>
+   static Handle EditImpl(Handle base, Func& edit) {
+      typename Ops::Transient session{Version(base)};
+      edit(session);
+      Handle res = session.Freeze().Root();
+      Ops::AddRef(res);
+      return res;
+   }
+
+   void Release(VersionId id) {
+      RootOf(id);
+      Ops::Release(versions[id].root);
+      versions[id].root = nullptr;
+      versions[id].alive = false;
+   }
+
+};
+
+#ifndef TREAP_VERSIONHEAP_H
+#define TREAP_VERSIONHEAP_H
+
+#endif //TREAP_VERSIONHEAP_H
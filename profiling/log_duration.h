@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "profiler.h"
+
+class LogDuration {
+public:
+    explicit LogDuration(const std::string& msg = "")
+            : message(msg)
+            , start(NSProfiler::NowNs())
+#ifdef DS_PROFILING
+            , timer(NSProfiler::Profiler::Instance().Intern(msg))
+#endif
+    {
+    }
+
+    ~LogDuration() {
+        std::uint64_t finish = NSProfiler::NowNs();
+        std::cerr << message << ": "
+                  << (finish - start) / 1e6
+                  << " ms" << std::endl;
+    }
+private:
+    std::string message;
+    std::uint64_t start;
+#ifdef DS_PROFILING
+    NSProfiler::ScopedTimer timer;
+#endif
+};
+
+#define UNIQ_ID_IMPL(lineno) _a_local_var_##lineno
+#define UNIQ_ID(lineno) UNIQ_ID_IMPL(lineno)
+
+#define LOG_DURATION(message) \
+  LogDuration UNIQ_ID(__LINE__){message};
+
+#ifndef PROFILING_LOG_DURATION_H
+#define PROFILING_LOG_DURATION_H
+
+#endif //PROFILING_LOG_DURATION_H
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace NSProfiler {
+
+    inline std::uint64_t NowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct Event {
+        const char* name;
+        std::uint64_t start_ns;
+        std::uint64_t end_ns;
+        std::uint32_t depth;
+        std::uint32_t thread_id;
+    };
+
+    struct ScopeStats {
+        std::string name;
+        std::uint64_t count{0};
+        std::uint64_t total_ns{0};
+        std::uint64_t p50_ns{0};
+        std::uint64_t p90_ns{0};
+        std::uint64_t p99_ns{0};
+        std::uint64_t max_ns{0};
+    };
+
+    /*!
+     * \brief Буфер событий одного потока. Пишет только владелец: событие кладётся в блок,
+     * затем публикуется увеличением size, поэтому читатель видит только готовые события.
+    */
+    class ThreadBuffer {
+    public:
+        static constexpr size_t kChunkSize = 4096;
+        static constexpr size_t kMaxChunks = 1024;
+
+        explicit ThreadBuffer(std::uint32_t id)
+                : thread_id(id)
+        {}
+
+        ~ThreadBuffer() {
+            for (auto& chunk : chunks) {
+                delete[] chunk.load();
+            }
+        }
+
+        void Append(const char* name, std::uint64_t start_ns, std::uint64_t end_ns, std::uint32_t depth) {
+            size_t pos = size.load(std::memory_order_relaxed);
+            size_t chunk_id = pos / kChunkSize;
+            if (chunk_id >= kMaxChunks) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            Event* chunk = chunks[chunk_id].load(std::memory_order_relaxed);
+            if (chunk == nullptr) {
+                chunk = new Event[kChunkSize];
+                chunks[chunk_id].store(chunk, std::memory_order_release);
+            }
+            chunk[pos % kChunkSize] = Event{name, start_ns, end_ns, depth, thread_id};
+            size.store(pos + 1, std::memory_order_release);
+        }
+
+        void CollectTo(std::vector<Event>& events) const {
+            size_t end = size.load(std::memory_order_acquire);
+            for (size_t pos = first.load(std::memory_order_acquire); pos < end; ++pos) {
+                events.push_back(chunks[pos / kChunkSize].load(std::memory_order_acquire)[pos % kChunkSize]);
+            }
+        }
+
+        void Skip() {
+            first.store(size.load(std::memory_order_acquire), std::memory_order_release);
+        }
+
+        std::uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+        std::uint32_t depth{0};
+
+    private:
+        std::uint32_t thread_id;
+        std::atomic<size_t> size{0};
+        std::atomic<size_t> first{0};
+        std::atomic<std::uint64_t> dropped{0};
+        std::array<std::atomic<Event*>, kMaxChunks> chunks{};
+    };
+
+    /*!
+     * \brief Сбор событий всех потоков, агрегаты по именам и выгрузка в Chrome trace (chrome://tracing).
+    */
+    class Profiler {
+    public:
+        static Profiler& Instance() {
+            static Profiler profiler;
+            return profiler;
+        }
+
+        ThreadBuffer& LocalBuffer() {
+            thread_local std::shared_ptr<ThreadBuffer> buffer = Register();
+            return *buffer;
+        }
+
+        /*!
+         * \brief Имя с временем жизни до конца программы, для динамических строк (LogDuration)
+        */
+        const char* Intern(const std::string& name) {
+            std::lock_guard<std::mutex> locker(m_);
+            return names.insert(name).first->c_str();
+        }
+
+        std::vector<Event> Collect() const {
+            std::vector<Event> events;
+            std::lock_guard<std::mutex> locker(m_);
+            for (const auto& buffer : buffers) {
+                buffer->CollectTo(events);
+            }
+            return events;
+        }
+
+        /*!
+         * \brief Забыть уже записанные события, потоки продолжают писать
+        */
+        void Clear() {
+            std::lock_guard<std::mutex> locker(m_);
+            for (auto& buffer : buffers) {
+                buffer->Skip();
+            }
+        }
+
+        std::uint64_t Dropped() const {
+            std::uint64_t res = 0;
+            std::lock_guard<std::mutex> locker(m_);
+            for (const auto& buffer : buffers) {
+                res += buffer->Dropped();
+            }
+            return res;
+        }
+
+        std::vector<ScopeStats> Summary() const {
+            std::map<std::string, std::vector<std::uint64_t>> durations;
+            for (const auto& event : Collect()) {
+                durations[event.name].push_back(event.end_ns - event.start_ns);
+            }
+
+            std::vector<ScopeStats> res;
+            for (auto& [name, values] : durations) {
+                std::sort(values.begin(), values.end());
+                ScopeStats stats;
+                stats.name = name;
+                stats.count = values.size();
+                for (auto value : values) {
+                    stats.total_ns += value;
+                }
+                auto percentile = [&values](double q) {
+                    return values[std::min(values.size() - 1, static_cast<size_t>(q * values.size()))];
+                };
+                stats.p50_ns = percentile(0.5);
+                stats.p90_ns = percentile(0.9);
+                stats.p99_ns = percentile(0.99);
+                stats.max_ns = values.back();
+                res.push_back(stats);
+            }
+            return res;
+        }
+
+        void WriteSummaryJson(std::ostream& out) const {
+            out << "[";
+            bool first = true;
+            for (const auto& stats : Summary()) {
+                out << (first ? "" : ",") << "\n  {\"name\": ";
+                WriteJsonString(out, stats.name);
+                out << ", \"count\": " << stats.count << ", \"total_ns\": " << stats.total_ns
+                    << ", \"p50_ns\": " << stats.p50_ns << ", \"p90_ns\": " << stats.p90_ns
+                    << ", \"p99_ns\": " << stats.p99_ns << ", \"max_ns\": " << stats.max_ns << "}";
+                first = false;
+            }
+            out << "\n]\n";
+        }
+
+        void WriteChromeTrace(std::ostream& out) const {
+            auto events = Collect();
+            std::uint64_t origin = events.empty() ? 0 : events.front().start_ns;
+            for (const auto& event : events) {
+                origin = std::min(origin, event.start_ns);
+            }
+
+            out << "{\"traceEvents\": [";
+            bool first = true;
+            for (const auto& event : events) {
+                out << (first ? "" : ",") << "\n  {\"name\": ";
+                WriteJsonString(out, event.name);
+                out << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " << event.thread_id
+                    << ", \"ts\": " << (event.start_ns - origin) / 1000.0
+                    << ", \"dur\": " << (event.end_ns - event.start_ns) / 1000.0
+                    << ", \"args\": {\"depth\": " << event.depth << "}}";
+                first = false;
+            }
+            out << "\n]}\n";
+        }
+
+    private:
+        mutable std::mutex m_;
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        std::set<std::string> names;
+
+        Profiler() = default;
+
+        std::shared_ptr<ThreadBuffer> Register() {
+            std::lock_guard<std::mutex> locker(m_);
+            buffers.push_back(std::make_shared<ThreadBuffer>(buffers.size()));
+            return buffers.back();
+        }
+
+        static void WriteJsonString(std::ostream& out, const std::string& str) {
+            out << '"';
+            for (char c : str) {
+                if (c == '"' || c == '\\') {
+                    out << '\\' << c;
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    out << ' ';
+                } else {
+                    out << c;
+                }
+            }
+            out << '"';
+        }
+    };
+
+    /*!
+     * \brief Замер области видимости, name должен жить до конца программы (строковый литерал)
+    */
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(const char* scope_name)
+                : name(scope_name)
+                , buffer(Profiler::Instance().LocalBuffer())
+                , depth(buffer.depth++)
+                , start(NowNs())
+        {}
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+        ~ScopedTimer() {
+            std::uint64_t finish = NowNs();
+            buffer.depth--;
+            buffer.Append(name, start, finish, depth);
+        }
+
+    private:
+        const char* name;
+        ThreadBuffer& buffer;
+        std::uint32_t depth;
+        std::uint64_t start;
+    };
+
+};
+
+#define PROFILER_UNIQ_ID_IMPL(lineno) _profiler_local_var_##lineno
+#define PROFILER_UNIQ_ID(lineno) PROFILER_UNIQ_ID_IMPL(lineno)
+
+#ifdef DS_PROFILING
+#define PROFILE_SCOPE(name) \
+  NSProfiler::ScopedTimer PROFILER_UNIQ_ID(__LINE__){name};
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+#ifndef PROFILING_PROFILER_H
+#define PROFILING_PROFILER_H
+
+#endif //PROFILING_PROFILER_H
@@ -3,8 +3,13 @@
 #include <map>
 
 #include "rpForest.h"
+#include "rpForestExternal.h"
+#include "rpForestHandle.h"
+#include "rpForestCache.h"
 #include "log_duration.h"
 
+using namespace std;
+
 using Pint = NSrpForest::Point<int>;
 
 template <typename T>
@@ -114,7 +119,12 @@ int main() {
 
     while(true) {
         cout << "Input test number:\n 1 - tiny test (train - 400, test - 100);\n 2 - big test (train - 1e6, test - 1e4);\n "
-                "3 - binary write/read test;\n 4 - correctness test (train - 1e4, test - 1e3);\n 0 - exit;" << endl;
+                "3 - binary write/read test;\n 4 - correctness test (train - 1e4, test - 1e3);\n "
+                "5 - out-of-core build test (train - 1e5, memory budget - 1 MB);\n 6 - all kNN graph test (train - 1e4);\n "
+                "7 - queries during rebuild test (train - 1e4);\n 8 - query cache test (train - 1e4);\n "
+                "9 - adaptive search test (train - 1e4, test - 200);\n "
+                "10 - dimensionality reduction test (train - 1e4, dimension 64 -> 16);\n "
+                "11 - lazy index loading test (train - 1e5, 50 trees);\n 0 - exit;" << endl;
         int x;
         cin >> x;
 
@@ -203,10 +213,216 @@ int main() {
             }
 
             TestForest(train, nn_count, 1000, trees_count, pt_size);
+        } else if (x == 5) {
+            {
+                NSrpForest::PointStoreWriter<int> store("test_points_bin");
+                for (int i = 0; i < 1e5; ++i) {
+                    Pint p = GeneratePint(2);
+                    if (train.insert(p).second) {
+                        store.Add(p);
+                    }
+                }
+            }
+
+            {
+                LOG_DURATION("out-of-core build")
+                NSrpForest::ExternalBuildOptions options;
+                options.memory_budget = 1 << 20;
+                NSrpForest::ExternalForestBuilder<int> builder("test_points_bin", options);
+                builder.BuildTo("test_index_bin", 10);
+            }
+
+            std::ifstream index("test_index_bin", ios_base::binary);
+            NSrpForest::RpForest<int> disk_forest;
+            disk_forest.ReadForestFrom(index);
+
+            Pint p_test({250, 250});
+            auto ans = disk_forest.KnnForPoint(p_test, nn_count);
+            ans.resize(std::min<size_t>(ans.size(), nn_count));
+            std::cout << "out-of-core forest: " << ans << std::endl;
+        } else if (x == 6) {
+            for (int i = 0; i < 1e4; ++i) {
+                train.insert(GeneratePint(2));
+            }
+            NSrpForest::RpForest<int> forest(train, 10, 4);
+
+            NSrpForest::KnnGraph graph;
+            {
+                LOG_DURATION("all kNN graph")
+                graph = forest.AllKnnGraph(nn_count, 10, 4);
+            }
+
+            vector<Pint> all_train(train.begin(), train.end());
+            int found = 0, checked = 0;
+            for (size_t i = 0; i < all_train.size(); i += 100) {
+                vector<long long> dists;
+                for (size_t j = 0; j < all_train.size(); ++j) {
+                    if (j != i) {
+                        dists.push_back(Distance(all_train[i], all_train[j]));
+                    }
+                }
+                std::nth_element(dists.begin(), dists.begin() + nn_count - 1, dists.end());
+                long long kth = dists[nn_count - 1];
+                for (int pos = graph.offsets[i]; pos < graph.offsets[i + 1]; ++pos) {
+                    found += graph.distances[pos] <= kth;
+                }
+                checked += nn_count;
+            }
+            cout << "graph recall: " << double(found) / checked << endl;
+        } else if (x == 7) {
+            for (int i = 0; i < 1e4; ++i) {
+                train.insert(GeneratePint(2));
+            }
+            NSrpForest::RpForestHandle<int> handle;
+            handle.RebuildAsync(train, 10, 4).get();
+
+            std::atomic<bool> stop{false};
+            std::atomic<int> queries{0};
+            auto reader = [&]() {
+                while (!stop) {
+                    handle.KnnForPoint(GeneratePint(2), nn_count);
+                    queries++;
+                }
+            };
+            auto r1 = std::async(std::launch::async, reader);
+            auto r2 = std::async(std::launch::async, reader);
+
+            {
+                LOG_DURATION("rebuild while querying")
+                for (int i = 0; i < 3; ++i) {
+                    handle.RebuildAsync(train, 10, 2).get();
+                }
+            }
+            stop = true;
+            r1.get();
+            r2.get();
+            cout << "queries served: " << queries << ", snapshots published: " << (handle.Generation() >> 32u) << endl;
+        } else if (x == 8) {
+            for (int i = 0; i < 1e4; ++i) {
+                train.insert(GeneratePint(2));
+            }
+            NSrpForest::RpForest<int> forest(train, 10, 4);
+            NSrpForest::QueryCacheOptions options;
+            options.capacity = 512;
+            options.quantization_step = 2;
+            NSrpForest::QueryCache<int> cache(options);
+
+            {
+                LOG_DURATION("1000 queries from 100 points through cache")
+                for (int i = 0; i < 1000; ++i) {
+                    Pint p_test({rand() % 10 * 50, rand() % 10 * 50});
+                    cache.KnnForPoint(forest, p_test, nn_count);
+                }
+            }
+            auto stats = cache.Stats();
+            cout << "hits: " << stats.hits << ", misses: " << stats.misses
+                 << ", evictions: " << stats.evictions << endl;
+        } else if (x == 9) {
+            for (int i = 0; i < 1e4; ++i) {
+                train.insert(GeneratePint(2));
+            }
+            int trees_count = 50;
+            NSrpForest::RpForest<int> forest(train, trees_count, 4);
+
+            vector<Pint> tests;
+            for (int i = 0; i < 200; ++i) {
+                tests.push_back(GeneratePint(2));
+            }
+
+            int same = 0;
+            long long trees_used = 0;
+            {
+                LOG_DURATION("adaptive KNN finding")
+                for (auto& p_test : tests) {
+                    auto adaptive = forest.KnnForPointAdaptive(p_test, nn_count, 3);
+                    trees_used += adaptive.trees_used;
+
+                    auto full = forest.KnnForPoint(p_test, nn_count);
+                    full.resize(std::min<size_t>(full.size(), nn_count));
+                    same += adaptive.points == full;
+                }
+            }
+            cout << "average trees: " << double(trees_used) / tests.size() << " of " << trees_count
+                 << ", same answer as full forest: " << same << " of " << tests.size() << endl;
+        } else if (x == 10) {
+            for (int i = 0; i < 1e4; ++i) {
+                train.insert(GeneratePint(64));
+            }
+            vector<Pint> all_train(train.begin(), train.end());
+            vector<Pint> tests;
+            for (int i = 0; i < 100; ++i) {
+                tests.push_back(GeneratePint(64));
+            }
+
+            auto recall = [&](const NSrpForest::RpForest<int>& forest) {
+                int found = 0;
+                for (auto& p_test : tests) {
+                    vector<long long> dists;
+                    for (auto& p : all_train) {
+                        dists.push_back(Distance(p, p_test));
+                    }
+                    std::nth_element(dists.begin(), dists.begin() + nn_count - 1, dists.end());
+                    auto ans = forest.KnnForPoint(p_test, nn_count);
+                    for (int j = 0; j < nn_count && j < static_cast<int>(ans.size()); ++j) {
+                        found += Distance(ans[j], p_test) <= dists[nn_count - 1];
+                    }
+                }
+                return double(found) / (tests.size() * nn_count);
+            };
+
+            NSrpForest::ReductionOptions options;
+            options.target_dimension = 16;
+            for (auto type : {NSrpForest::ReductionType::None, NSrpForest::ReductionType::RandomProjection,
+                              NSrpForest::ReductionType::Pca}) {
+                options.type = type;
+                NSrpForest::RpForest<int> forest(train, 10, 4, options);
+                cout << "reduction " << static_cast<int>(type) << " recall: " << recall(forest);
+
+                std::ofstream test_f("test_bin", ios_base::binary);
+                forest.WriteForestTo(test_f);
+                test_f.close();
+                std::ifstream test_read("test_bin", ios_base::binary);
+                NSrpForest::RpForest<int> readable_forest;
+                readable_forest.ReadForestFrom(test_read);
+                cout << ", after read: " << recall(readable_forest) << endl;
+            }
+        } else if (x == 11) {
+            for (int i = 0; i < 1e5; ++i) {
+                train.insert(GeneratePint(2));
+            }
+            {
+                NSrpForest::RpForest<int> forest(train, 50, 4);
+                std::ofstream test_f("test_bin", ios_base::binary);
+                forest.WriteForestTo(test_f);
+            }
+
+            Pint p_test({250, 250});
+            NSrpForest::RpForestHandle<int> handle;
+            {
+                LOG_DURATION("lazy open")
+                handle.OpenLazy("test_bin", 2);
+            }
+            auto ans = handle.KnnForPoint(p_test, nn_count);
+            ans.resize(std::min<size_t>(ans.size(), nn_count));
+            cout << "first answer with " << handle.Acquire()->LoadedTrees() << " trees: " << ans << endl;
+
+            {
+                LOG_DURATION("background loading")
+                handle.Acquire()->WaitLoaded();
+            }
+            ans = handle.KnnForPoint(p_test, nn_count);
+            ans.resize(std::min<size_t>(ans.size(), nn_count));
+            cout << "answer with " << handle.Acquire()->LoadedTrees() << " trees: " << ans << endl;
         } else if (x == 0) {
             break;
         }
     }
 
+#ifdef DS_PROFILING
+    std::ofstream trace("trace.json");
+    NSProfiler::Profiler::Instance().WriteChromeTrace(trace);
+    NSProfiler::Profiler::Instance().WriteSummaryJson(std::cout);
+#endif
+
     return 0;
 }
\ No newline at end of file
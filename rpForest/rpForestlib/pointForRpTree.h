@@ -60,7 +60,7 @@ namespace NSrpForest {
             return coordinates < second.coordinates;
         }
 
-        bool operator==(const Point<NumericType>& second) {
+        bool operator==(const Point<NumericType>& second) const {
             if (second.Dimension() != Dimension()) {
                 throw PointException("diff dimensions");
             }
@@ -68,7 +68,7 @@ namespace NSrpForest {
             return coordinates == second.coordinates;
         }
 
-        bool operator!=(const Point<NumericType>& second) {
+        bool operator!=(const Point<NumericType>& second) const {
             return !operator==(second);
         }
 
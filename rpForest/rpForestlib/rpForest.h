@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <future>
 #include <mutex>
+#include <map>
+#include <memory>
 #include "rpTree.h"
+#include "rpForestReduction.h"
+#include "profiler.h"
 
 
 namespace NSrpForest {
@@ -19,11 +24,37 @@ namespace NSrpForest {
         std::string message{""};
     };
 
+    /*!
+     * \brief Граф k ближайших соседей в формате CSR.
+     * Вершина i - i-я точка обучающей выборки (в порядке std::set), её соседи -
+     * neighbors[offsets[i]..offsets[i + 1]) по возрастанию расстояния.
+    */
+    struct KnnGraph {
+        std::vector<int> offsets;
+        std::vector<int> neighbors;
+        std::vector<long long> distances;
+    };
+
+    /*!
+     * \brief Ответ адаптивного поиска: k ближайших по возрастанию расстояния и число просмотренных деревьев
+    */
+    template<typename NumericType>
+    struct AdaptiveKnnResult {
+        std::vector<Point<NumericType>> points;
+        int trees_used{0};
+    };
+
     template<typename NumericType>
     class RpForest {
     public:
         RpForest() = default;
 
+        ~RpForest() {
+            if (loading.valid()) {
+                loading.wait();
+            }
+        }
+
         RpForest(const std::set<Point<NumericType>>& train, int how_much)
                 : U(train)
                 , how_much_trees_in_forest(how_much)
@@ -40,13 +71,24 @@ namespace NSrpForest {
 
         RpForest(const std::set<Point<NumericType>> &train, int how_much, int thread_count);
 
-        std::vector<Point<NumericType>> KnnForPoint(const Point<NumericType>& point_q, int k) {
+        /*!
+         * \brief Лес строится и ищет в пространстве пониженной размерности,
+         * итоговые кандидаты сортируются по расстоянию в исходном пространстве
+        */
+        RpForest(const std::set<Point<NumericType>> &train, int how_much, int thread_count,
+                 const ReductionOptions& reduction);
+
+        std::vector<Point<NumericType>> KnnForPoint(const Point<NumericType>& point_q, int k) const {
+            PROFILE_SCOPE("RpForest::KnnForPoint")
             std::set<Point<NumericType>> all_knn;
+            auto tree_q = TreeQuery(point_q);
 
-            for (auto& tree : forest) {
-                auto knn_for_tree = tree.FindKnn(point_q);
+            for (size_t i = 0, ready = ReadyTrees(); i < ready; ++i) {
+                const auto& knn_for_tree = forest[i].FindKnn(tree_q);
                 for (const auto& k_point : knn_for_tree) {
-                    all_knn.insert(k_point);
+                    ForEachOriginal(k_point, [&all_knn](const Point<NumericType>& original) {
+                        all_knn.insert(original);
+                    });
                 }
             }
 
@@ -74,7 +116,67 @@ namespace NSrpForest {
             return res;
         }
 
+        /*!
+         * \brief Поиск с ранней остановкой: деревья просматриваются по порядку, поиск заканчивается,
+         * когда top-k не менялся patience деревьев подряд
+        */
+        AdaptiveKnnResult<NumericType> KnnForPointAdaptive(const Point<NumericType>& point_q, int k, int patience) const {
+            PROFILE_SCOPE("RpForest::KnnForPointAdaptive")
+            if (k <= 0 || patience <= 0) {
+                throw RpForestExperssion("k and patience must be >= 1");
+            }
+
+            std::set<Point<NumericType>> seen;
+            std::vector<std::pair<long long, Point<NumericType>>> top;
+            AdaptiveKnnResult<NumericType> res;
+            int stable_trees = 0;
+            auto tree_q = TreeQuery(point_q);
+
+            for (size_t i = 0, ready = ReadyTrees(); i < ready; ++i) {
+                bool changed = false;
+                for (const auto& k_point : forest[i].FindKnn(tree_q)) {
+                    ForEachOriginal(k_point, [&](const Point<NumericType>& original) {
+                        if (!seen.insert(original).second) {
+                            return;
+                        }
+                        std::pair<long long, Point<NumericType>> candidate(Distance(original, point_q), original);
+                        if (top.size() == static_cast<size_t>(k) && !(candidate < top.back())) {
+                            return;
+                        }
+                        top.insert(std::upper_bound(top.begin(), top.end(), candidate), candidate);
+                        if (top.size() > static_cast<size_t>(k)) {
+                            top.pop_back();
+                        }
+                        changed = true;
+                    });
+                }
+
+                res.trees_used++;
+                stable_trees = changed ? 0 : stable_trees + 1;
+                if (stable_trees >= patience && top.size() == static_cast<size_t>(k)) {
+                    break;
+                }
+            }
+
+            res.points.reserve(top.size());
+            for (auto& now : top) {
+                res.points.push_back(std::move(now.second));
+            }
+            return res;
+        }
+
+        KnnGraph AllKnnGraph(int k, int iterations = 10, int thread_count = 1) const;
+
         void WriteForestTo(std::ofstream& file) const {
+            if (loading.valid()) {
+                loading.wait();
+            }
+            if (!projector.Empty()) {
+                int reduction_marker = -1;
+                file.write(reinterpret_cast<const char*>(&reduction_marker), sizeof(reduction_marker));
+                projector.WriteProjectorTo(file);
+            }
+
             int Usize = U.size();
             file.write(reinterpret_cast<const char*>(&Usize), sizeof(Usize));
             for (const auto& point : U) {
@@ -89,35 +191,315 @@ namespace NSrpForest {
         }
 
         void ReadForestFrom(std::ifstream& file) {
+            PROFILE_SCOPE("RpForest::ReadForestFrom")
+            ReadForestHeader(file);
+            for (int i = 0; i < how_much_trees_in_forest; ++i) {
+                RpTree<NumericType> tree;
+                tree.ReadTreeFrom(file);
+                forest.push_back(tree);
+            }
+        }
+
+        /*!
+         * \brief Ленивое открытие индекса: выборка и первые initial_trees деревьев читаются сразу,
+         * остальные деревья дочитываются в фоне. Запросы используют уже загруженные деревья.
+        */
+        void OpenForestLazy(const std::string& path, int initial_trees) {
+            auto file = std::make_shared<std::ifstream>(path, std::ios_base::binary);
+            if (!*file) {
+                throw RpForestExperssion("cant open forest file " + path);
+            }
+
+            ReadForestHeader(*file);
+            forest.resize(how_much_trees_in_forest);
+            initial_trees = std::max(0, std::min(initial_trees, how_much_trees_in_forest));
+            for (int i = 0; i < initial_trees; ++i) {
+                forest[i].ReadTreeFrom(*file);
+            }
+            loaded_trees.store(initial_trees, std::memory_order_release);
+
+            loading = std::async(std::launch::async, [this, file, initial_trees]() {
+                for (int i = initial_trees; i < how_much_trees_in_forest; ++i) {
+                    PROFILE_SCOPE("RpForest::LazyReadTree")
+                    forest[i].ReadTreeFrom(*file);
+                    loaded_trees.store(i + 1, std::memory_order_release);
+                }
+            }).share();
+        }
+
+        /*!
+         * \brief Сколько деревьев уже доступно запросам
+        */
+        int LoadedTrees() const {
+            return ReadyTrees();
+        }
+
+        void WaitLoaded() const {
+            if (loading.valid()) {
+                loading.wait();
+            }
+        }
+
+    private:
+        void ReadForestHeader(std::ifstream& file) {
+            WaitLoaded();
+            loading = std::shared_future<void>();
+            loaded_trees.store(-1, std::memory_order_release);
+
             U.clear();
             forest.clear();
+            originals.clear();
+            projector = PointProjector<NumericType>();
 
+            // Отрицательный размер выборки - признак сохранённого понижения размерности
             int Usize;
             file.read(reinterpret_cast<char*>(&Usize), sizeof(Usize));
+            if (Usize < 0) {
+                projector.ReadProjectorFrom(file);
+                file.read(reinterpret_cast<char*>(&Usize), sizeof(Usize));
+            }
             for (int i = 0; i < Usize; ++i) {
                 Point<NumericType> point;
                 point.ReadPointFrom(file);
                 U.insert(point);
             }
+            if (!projector.Empty()) {
+                for (const auto& point : U) {
+                    originals[projector.Project(point)].push_back(point);
+                }
+            }
 
             file.read(reinterpret_cast<char*>(&how_much_trees_in_forest), sizeof(how_much_trees_in_forest));
-            for (int i = 0; i < how_much_trees_in_forest; ++i) {
-                RpTree<NumericType> tree;
-                tree.ReadTreeFrom(file);
-                forest.push_back(tree);
-            }
         }
 
-    private:
         std::set<Point<NumericType>> U;
         int how_much_trees_in_forest{1};
         std::vector<RpTree<NumericType>> forest;
         std::mutex m_;
 
+        std::atomic<int> loaded_trees{-1}; // -1 - загружены все деревья
+        std::shared_future<void> loading;
+
+        PointProjector<NumericType> projector;
+        std::map<Point<NumericType>, std::vector<Point<NumericType>>> originals; // точка дерева -> исходные точки
+
         static void MakeTrees(RpForest<NumericType>* now_forest, const std::set<Point<NumericType>> &train, int trees_count);
 
+        void BuildTrees(const std::set<Point<NumericType>>& train, int thread_count);
+
+        size_t ReadyTrees() const {
+            int ready = loaded_trees.load(std::memory_order_acquire);
+            return ready < 0 ? forest.size() : ready;
+        }
+
+        Point<NumericType> TreeQuery(const Point<NumericType>& point_q) const {
+            return projector.Empty() ? point_q : projector.Project(point_q);
+        }
+
+        template <typename Func>
+        void ForEachOriginal(const Point<NumericType>& tree_point, Func&& func) const {
+            if (projector.Empty()) {
+                func(tree_point);
+                return;
+            }
+            auto it = originals.find(tree_point);
+            if (it != originals.end()) {
+                for (const auto& original : it->second) {
+                    func(original);
+                }
+            }
+        }
+
+        struct GraphCandidate {
+            long long dist;
+            int id;
+            bool is_new;
+        };
+
+        static bool TryAddCandidate(std::vector<GraphCandidate>& list, int k, long long dist, int id);
+
     };
 
+    template <typename NumericType>
+    bool RpForest<NumericType>::TryAddCandidate(std::vector<GraphCandidate>& list, int k, long long dist, int id) {
+        auto less = [](const GraphCandidate& first, const GraphCandidate& second) {
+            if (first.dist != second.dist) {
+                return first.dist < second.dist;
+            }
+            return first.id < second.id;
+        };
+
+        GraphCandidate candidate{dist, id, true};
+        if (list.size() == static_cast<size_t>(k) && !less(candidate, list.back())) {
+            return false;
+        }
+        for (const auto& now : list) {
+            if (now.id == id) {
+                return false;
+            }
+        }
+
+        list.insert(std::upper_bound(list.begin(), list.end(), candidate, less), candidate);
+        if (list.size() > static_cast<size_t>(k)) {
+            list.pop_back();
+        }
+        return true;
+    }
+
+    template <typename NumericType>
+    KnnGraph RpForest<NumericType>::AllKnnGraph(int k, int iterations, int thread_count) const {
+        PROFILE_SCOPE("RpForest::AllKnnGraph")
+        if (k <= 0) {
+            throw RpForestExperssion("k must be >= 1");
+        }
+        if (thread_count <= 0) {
+            throw RpForestExperssion("min count of threads is 1!!");
+        }
+
+        std::vector<Point<NumericType>> points(U.begin(), U.end());
+        int n = points.size();
+        auto id_of = [&points](const Point<NumericType>& point) {
+            return static_cast<int>(std::lower_bound(points.begin(), points.end(), point) - points.begin());
+        };
+
+        std::vector<std::vector<GraphCandidate>> lists(n);
+        const int lock_stripes = 1024;
+        std::vector<std::mutex> locks(lock_stripes);
+        std::atomic<long long> updates{0};
+
+        auto join = [&](int a, int b) {
+            long long dist = Distance(points[a], points[b]);
+            bool changed = false;
+            {
+                std::lock_guard<std::mutex> locker(locks[a % lock_stripes]);
+                changed |= TryAddCandidate(lists[a], k, dist, b);
+            }
+            {
+                std::lock_guard<std::mutex> locker(locks[b % lock_stripes]);
+                changed |= TryAddCandidate(lists[b], k, dist, a);
+            }
+            if (changed) {
+                updates++;
+            }
+        };
+
+        auto run_parallel = [thread_count](int count, auto&& body) {
+            std::vector<std::future<void>> tasks;
+            int chunk = (count + thread_count - 1) / thread_count;
+            for (int begin = 0; begin < count; begin += chunk) {
+                int end = std::min(count, begin + chunk);
+                tasks.push_back(std::async(std::launch::async, [&body, begin, end]() {
+                    for (int i = begin; i < end; ++i) {
+                        body(i);
+                    }
+                }));
+            }
+            for (auto& task : tasks) {
+                task.get();
+            }
+        };
+
+        // Начальные кандидаты: все пары точек из общего листа, каждая пара считается один раз
+        std::vector<std::vector<int>> leaves;
+        std::vector<char> covered(n, 0);
+        for (size_t i = 0, ready = ReadyTrees(); i < ready; ++i) {
+            forest[i].ForEachLeaf([&](const std::set<Point<NumericType>>& leaf) {
+                std::vector<int> ids;
+                ids.reserve(leaf.size());
+                for (const auto& point : leaf) {
+                    ForEachOriginal(point, [&](const Point<NumericType>& original) {
+                        ids.push_back(id_of(original));
+                        covered[ids.back()] = 1;
+                    });
+                }
+                leaves.push_back(std::move(ids));
+            });
+        }
+        run_parallel(leaves.size(), [&](int leaf_id) {
+            const auto& ids = leaves[leaf_id];
+            for (size_t i = 0; i < ids.size(); ++i) {
+                for (size_t j = i + 1; j < ids.size(); ++j) {
+                    join(ids[i], ids[j]);
+                }
+            }
+        });
+        leaves.clear();
+
+        // Точки, не попавшие ни в один лист, получают кандидатов спуском по деревьям
+        run_parallel(n, [&](int id) {
+            if (covered[id]) {
+                return;
+            }
+            auto tree_q = TreeQuery(points[id]);
+            for (size_t i = 0, ready = ReadyTrees(); i < ready; ++i) {
+                for (const auto& point : forest[i].FindKnn(tree_q)) {
+                    ForEachOriginal(point, [&](const Point<NumericType>& original) {
+                        int other = id_of(original);
+                        if (other != id) {
+                            join(id, other);
+                        }
+                    });
+                }
+            }
+        });
+
+        // NN-descent: соседи соседей, пока обновлений не станет мало
+        for (int iter = 0; iter < iterations; ++iter) {
+            std::vector<std::vector<int>> new_ids(n), old_ids(n);
+            std::vector<std::vector<int>> reverse_new(n), reverse_old(n);
+            for (int id = 0; id < n; ++id) {
+                for (auto& candidate : lists[id]) {
+                    auto& forward = candidate.is_new ? new_ids[id] : old_ids[id];
+                    auto& reverse = candidate.is_new ? reverse_new[candidate.id] : reverse_old[candidate.id];
+                    forward.push_back(candidate.id);
+                    if (reverse.size() < static_cast<size_t>(k)) {
+                        reverse.push_back(id);
+                    }
+                    candidate.is_new = false;
+                }
+            }
+            for (int id = 0; id < n; ++id) {
+                new_ids[id].insert(new_ids[id].end(), reverse_new[id].begin(), reverse_new[id].end());
+                old_ids[id].insert(old_ids[id].end(), reverse_old[id].begin(), reverse_old[id].end());
+            }
+
+            updates = 0;
+            run_parallel(n, [&](int id) {
+                const auto& news = new_ids[id];
+                const auto& olds = old_ids[id];
+                for (size_t i = 0; i < news.size(); ++i) {
+                    for (size_t j = i + 1; j < news.size(); ++j) {
+                        if (news[i] != news[j]) {
+                            join(news[i], news[j]);
+                        }
+                    }
+                    for (int old_id : olds) {
+                        if (news[i] != old_id) {
+                            join(news[i], old_id);
+                        }
+                    }
+                }
+            });
+
+            if (updates <= 0.001 * n * k) {
+                break;
+            }
+        }
+
+        KnnGraph graph;
+        graph.offsets.reserve(n + 1);
+        graph.offsets.push_back(0);
+        for (const auto& list : lists) {
+            for (const auto& candidate : list) {
+                graph.neighbors.push_back(candidate.id);
+                graph.distances.push_back(candidate.dist);
+            }
+            graph.offsets.push_back(graph.neighbors.size());
+        }
+
+        return graph;
+    }
+
     template <typename NumericType>
     void RpForest<NumericType>::MakeTrees(RpForest<NumericType>* now_forest, const std::set<Point<NumericType>>& train, int trees_count) {
         int leaf_size = train.size() * 0.05 > 2 ? train.size() * 0.05 : 2;
@@ -126,6 +508,7 @@ namespace NSrpForest {
         }
 
         for (int i = 0; i < trees_count; ++i) {
+            PROFILE_SCOPE("RpForest::MakeTree")
             auto new_tree = RpTree<NumericType>(train, leaf_size);
             std::lock_guard<std::mutex> locker(now_forest->m_);
             now_forest->forest.push_back(new_tree);
@@ -133,10 +516,7 @@ namespace NSrpForest {
     }
 
     template <typename NumericType>
-    RpForest<NumericType>::RpForest(const std::set<Point<NumericType>>& train, int how_much, int thread_count)
-        : U(train)
-        , how_much_trees_in_forest(how_much)
-    {
+    void RpForest<NumericType>::BuildTrees(const std::set<Point<NumericType>>& train, int thread_count) {
         if (thread_count <= 0) {
             throw RpForestExperssion("min count of threads is 1!!");
         }
@@ -149,9 +529,40 @@ namespace NSrpForest {
         forest.reserve(how_much_trees_in_forest);
 
         std::vector<std::future<void>> async_trees;
+        int extra_trees = how_much_trees_in_forest % thread_count;
         for (int i = 0; i < thread_count; ++i) {
-            async_trees.push_back(std::async(MakeTrees, this, std::ref(train), size_for_one_thread));
+            int trees_count = size_for_one_thread + (i < extra_trees ? 1 : 0);
+            async_trees.push_back(std::async(MakeTrees, this, std::ref(train), trees_count));
+        }
+    }
+
+    template <typename NumericType>
+    RpForest<NumericType>::RpForest(const std::set<Point<NumericType>>& train, int how_much, int thread_count)
+        : U(train)
+        , how_much_trees_in_forest(how_much)
+    {
+        BuildTrees(train, thread_count);
+    }
+
+    template <typename NumericType>
+    RpForest<NumericType>::RpForest(const std::set<Point<NumericType>>& train, int how_much, int thread_count,
+                                    const ReductionOptions& reduction)
+        : U(train)
+        , how_much_trees_in_forest(how_much)
+    {
+        projector.Fit(U, reduction);
+        if (projector.Empty()) {
+            BuildTrees(U, thread_count);
+            return;
+        }
+
+        std::set<Point<NumericType>> reduced;
+        for (const auto& point : U) {
+            auto tree_point = projector.Project(point);
+            originals[tree_point].push_back(point);
+            reduced.insert(tree_point);
         }
+        BuildTrees(reduced, thread_count);
     }
 
 };
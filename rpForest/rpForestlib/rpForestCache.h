@@ -0,0 +1,198 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+
+#include "rpForestHandle.h"
+
+namespace NSrpForest {
+
+    struct QueryCacheOptions {
+        size_t capacity{1u << 16u};
+        int shards{16};
+        double quantization_step{0}; // 0 - точное совпадение запроса, иначе сетка с таким шагом
+    };
+
+    struct QueryCacheStats {
+        unsigned long long hits{0};
+        unsigned long long misses{0};
+        unsigned long long evictions{0};
+        unsigned long long invalidations{0};
+    };
+
+    /*!
+     * \brief Кэш ответов KnnForPoint перед RpForest или RpForestHandle.
+     * Ключ - запрос (или его округление до сетки quantization_step) и k, хранится не больше k точек.
+     * Кэш разбит на шарды со своим LRU и мьютексом. При смене поколения леса шард очищается.
+    */
+    template <typename NumericType>
+    class QueryCache {
+    public:
+        explicit QueryCache(const QueryCacheOptions& opts = QueryCacheOptions())
+                : options(opts)
+                , shards(opts.shards > 0 ? opts.shards : 1)
+        {
+            if (opts.capacity == 0) {
+                throw RpForestExperssion("cache capacity must be >= 1");
+            }
+            shard_capacity = (options.capacity + shards.size() - 1) / shards.size();
+        }
+
+        std::vector<Point<NumericType>> KnnForPoint(const RpForestHandle<NumericType>& handle,
+                                                    const Point<NumericType>& point_q, int k) {
+            unsigned long long generation = handle.Generation();
+            return Find(point_q, k, generation, [&]() { return handle.KnnForPoint(point_q, k); });
+        }
+
+        std::vector<Point<NumericType>> KnnForPoint(const RpForest<NumericType>& forest,
+                                                    const Point<NumericType>& point_q, int k) {
+            unsigned long long generation = local_generation.load(std::memory_order_acquire);
+            return Find(point_q, k, generation, [&]() { return forest.KnnForPoint(point_q, k); });
+        }
+
+        /*!
+         * \brief Сброс кэша для RpForest без handle: вызывать после изменения леса
+        */
+        void Invalidate() {
+            local_generation.fetch_add(1, std::memory_order_acq_rel);
+        }
+
+        QueryCacheStats Stats() const {
+            QueryCacheStats stats;
+            stats.hits = hits.load();
+            stats.misses = misses.load();
+            stats.evictions = evictions.load();
+            stats.invalidations = invalidations.load();
+            return stats;
+        }
+
+    private:
+        struct Key {
+            Point<NumericType> point;
+            int k;
+
+            bool operator==(const Key& second) const {
+                return k == second.k && point == second.point;
+            }
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                size_t res = std::hash<int>()(key.k);
+                for (size_t i = 0; i < key.point.Dimension(); ++i) {
+                    res ^= std::hash<NumericType>()(key.point.at(i)) + 0x9e3779b97f4a7c15ull + (res << 6u) + (res >> 2u);
+                }
+                return res;
+            }
+        };
+
+        using Entry = std::pair<Key, std::vector<Point<NumericType>>>;
+
+        struct Shard {
+            std::mutex m_;
+            unsigned long long generation{0};
+            std::list<Entry> lru;
+            std::unordered_map<Key, typename std::list<Entry>::iterator, KeyHash> index;
+        };
+
+        QueryCacheOptions options;
+        std::vector<Shard> shards;
+        size_t shard_capacity{1};
+        std::atomic<unsigned long long> local_generation{0};
+        std::atomic<unsigned long long> hits{0}, misses{0}, evictions{0}, invalidations{0};
+
+        Point<NumericType> Quantize(const Point<NumericType>& point) const {
+            if (options.quantization_step <= 0) {
+                return point;
+            }
+            Point<NumericType> res(point);
+            for (size_t i = 0; i < res.Dimension(); ++i) {
+                double cell = std::floor(point.at(i) / options.quantization_step);
+                res.at(i) = static_cast<NumericType>(cell * options.quantization_step);
+            }
+            return res;
+        }
+
+        // Поколения только растут: отстающий шард очищается, запрос со старым поколением кэш не трогает
+        bool CheckGeneration(Shard& shard, unsigned long long generation) {
+            if (shard.generation < generation) {
+                if (!shard.lru.empty()) {
+                    invalidations++;
+                }
+                shard.lru.clear();
+                shard.index.clear();
+                shard.generation = generation;
+            }
+            return shard.generation == generation;
+        }
+
+        template <typename Search>
+        std::vector<Point<NumericType>> Find(const Point<NumericType>& point_q, int k,
+                                             unsigned long long generation, Search&& search) {
+            Key key{Quantize(point_q), k};
+            Shard& shard = shards[KeyHash()(key) % shards.size()];
+
+            std::vector<Point<NumericType>> res;
+            bool found = false;
+            {
+                std::lock_guard<std::mutex> locker(shard.m_);
+                bool actual = CheckGeneration(shard, generation);
+                auto it = shard.index.find(key);
+                if (actual && it != shard.index.end()) {
+                    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                    res = it->second->second;
+                    found = true;
+                }
+            }
+
+            if (found) {
+                hits++;
+                if (options.quantization_step > 0) {
+                    SortByDistance(res, point_q);
+                }
+                return res;
+            }
+
+            misses++;
+            res = search();
+            if (res.size() > static_cast<size_t>(k)) {
+                res.resize(k);
+            }
+
+            std::lock_guard<std::mutex> locker(shard.m_);
+            if (CheckGeneration(shard, generation) && shard.index.count(key) == 0) {
+                shard.lru.emplace_front(key, res);
+                shard.index[key] = shard.lru.begin();
+                if (shard.lru.size() > shard_capacity) {
+                    shard.index.erase(shard.lru.back().first);
+                    shard.lru.pop_back();
+                    evictions++;
+                }
+            }
+            return res;
+        }
+
+        static void SortByDistance(std::vector<Point<NumericType>>& points, const Point<NumericType>& point_q) {
+            std::sort(points.begin(), points.end(),
+                      [&point_q](const Point<NumericType>& first, const Point<NumericType>& second) {
+                          long long d1 = Distance(first, point_q);
+                          long long d2 = Distance(second, point_q);
+                          if (d1 != d2) {
+                              return d1 < d2;
+                          }
+                          return first < second;
+                      });
+        }
+    };
+
+};
+
+#ifndef RPFOREST_RPFORESTCACHE_H
+#define RPFOREST_RPFORESTCACHE_H
+
+#endif //RPFOREST_RPFORESTCACHE_H
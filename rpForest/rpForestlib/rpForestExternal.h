@@ -0,0 +1,494 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "pointForRpTree.h"
+#include "profiler.h"
+
+namespace NSrpForest {
+
+    class ExternalBuildExpression {
+    public:
+        ExternalBuildExpression(const std::string& error_m)
+                : message(error_m)
+        {}
+
+        std::string GetError() { return message; }
+
+    private:
+        std::string message{""};
+    };
+
+    /*!
+     * \brief Хранилище точек на диске: int количество, затем точки в формате Point::WritePointTo.
+     * Совпадает с началом файла леса, поэтому обучающую выборку не нужно держать в памяти.
+    */
+    template <typename NumericType>
+    class PointStoreWriter {
+    public:
+        explicit PointStoreWriter(const std::string& path)
+                : file(path, std::ios_base::binary)
+        {
+            if (!file) {
+                throw ExternalBuildExpression("cant open point store " + path);
+            }
+            file.write(reinterpret_cast<const char*>(&points_count), sizeof(points_count));
+        }
+
+        ~PointStoreWriter() { Close(); }
+
+        void Add(const Point<NumericType>& point) {
+            point.WritePointTo(file);
+            points_count++;
+        }
+
+        void Close() {
+            if (!file.is_open()) {
+                return;
+            }
+            file.seekp(0);
+            file.write(reinterpret_cast<const char*>(&points_count), sizeof(points_count));
+            file.close();
+        }
+
+    private:
+        std::ofstream file;
+        int points_count{0};
+    };
+
+    struct ExternalBuildOptions {
+        std::string work_dir{"."};
+        size_t memory_budget{256u << 20u};
+        int leaf_size{0}; // 0 - как в RpForest: 5% выборки, но в пределах [2, 1000]
+    };
+
+    /*!
+     * \brief Построение леса для выборки, не помещающейся в память.
+     * Деревья строятся по уровням: каждая вершина - файл с её точками (bucket), разбиение делается
+     * последовательными проходами по файлу. Вершина, точки которой помещаются в memory_budget, дальше
+     * не режется на файлы: при записи её поддерево строится в памяти и сразу дописывается в индекс.
+     * Результат читается обычным RpForest::ReadForestFrom.
+    */
+    template <typename NumericType>
+    class ExternalForestBuilder {
+    public:
+        ExternalForestBuilder(const std::string& points_path, const ExternalBuildOptions& opts)
+                : store_path(points_path)
+                , options(opts)
+        {
+            std::ifstream store(store_path, std::ios_base::binary);
+            if (!store) {
+                throw ExternalBuildExpression("cant open point store " + store_path);
+            }
+            store.read(reinterpret_cast<char*>(&points_count), sizeof(points_count));
+            if (points_count <= 0) {
+                throw ExternalBuildExpression("point store is empty");
+            }
+            points_offset = store.tellg();
+
+            Point<NumericType> first;
+            first.ReadPointFrom(store);
+            dimension = first.Dimension();
+            point_bytes = sizeof(Point<NumericType>) + dimension * sizeof(NumericType);
+
+            leaf_size = options.leaf_size;
+            if (leaf_size <= 0) {
+                leaf_size = points_count * 0.05 > 2 ? points_count * 0.05 : 2;
+                if (leaf_size > 1000) {
+                    leaf_size = 1000;
+                }
+            }
+        }
+
+        void BuildTo(const std::string& index_path, int trees_count) {
+            if (trees_count <= 0) {
+                throw ExternalBuildExpression("trees count must be >= 1");
+            }
+
+            std::ofstream index(index_path, std::ios_base::binary);
+            if (!index) {
+                throw ExternalBuildExpression("cant open index " + index_path);
+            }
+
+            index.write(reinterpret_cast<const char*>(&points_count), sizeof(points_count));
+            {
+                Bucket all = RootBucket();
+                std::ifstream in = OpenBucket(all);
+                for (int i = 0; i < all.count; ++i) {
+                    Point<NumericType> point;
+                    point.ReadPointFrom(in);
+                    point.WritePointTo(index);
+                }
+            }
+
+            index.write(reinterpret_cast<const char*>(&trees_count), sizeof(trees_count));
+            for (int i = 0; i < trees_count; ++i) {
+                TreeFiles files{*this, i};
+                BuildTree(i);
+                WriteTree(index);
+            }
+        }
+
+    private:
+        struct Bucket {
+            std::string path;
+            std::streamoff offset{0};
+            int count{0};
+            bool temporary{false};
+        };
+
+        struct BuildNode {
+            Bucket bucket;
+            NumericType mid{0};
+            int projection{0};
+            int left{-1};
+            int right{-1};
+            bool in_memory{false};
+        };
+
+        // Удаляет файлы вершин дерева и тогда, когда построение прервано исключением
+        struct TreeFiles {
+            ExternalForestBuilder& builder;
+            int tree_id;
+
+            ~TreeFiles() { builder.ClearTree(tree_id); }
+        };
+
+        std::string store_path;
+        ExternalBuildOptions options;
+        int points_count{0};
+        std::streamoff points_offset{0};
+        size_t dimension{0};
+        size_t point_bytes{0};
+        int leaf_size{1};
+
+        std::vector<BuildNode> nodes;
+        std::mt19937_64 mersenne_random{std::random_device{}()};
+
+        Bucket RootBucket() const {
+            return Bucket{store_path, points_offset, points_count, false};
+        }
+
+        std::string BucketPath(int tree_id, int node_id, const char* suffix) const {
+            return options.work_dir + "/rpf_bucket_" + std::to_string(tree_id) + "_"
+                   + std::to_string(node_id) + suffix + ".bin";
+        }
+
+        std::ifstream OpenBucket(const Bucket& bucket) const {
+            std::ifstream in(bucket.path, std::ios_base::binary);
+            if (!in) {
+                throw ExternalBuildExpression("cant open bucket " + bucket.path);
+            }
+            in.seekg(bucket.offset);
+            return in;
+        }
+
+        static void DropBucket(const Bucket& bucket) {
+            if (bucket.temporary) {
+                std::remove(bucket.path.c_str());
+            }
+        }
+
+        bool FitsInMemory(int count) const {
+            return static_cast<size_t>(count) * point_bytes <= options.memory_budget;
+        }
+
+        std::vector<size_t> ProjectionCandidates() {
+            std::vector<size_t> dims(dimension / 2);
+            for (auto& dim : dims) {
+                dim = mersenne_random() % dimension;
+            }
+            return dims;
+        }
+
+        static int BestProjection(const std::vector<size_t>& dims, const std::vector<long double>& sums,
+                                  const std::vector<long double>& squares, int count) {
+            long double res_disp = 0;
+            int res_pr = 0;
+            for (size_t i = 0; i < dims.size(); ++i) {
+                long double avg = sums[i] / count;
+                long double disp = squares[i] / count - avg * avg;
+                if (disp > res_disp) {
+                    res_disp = disp;
+                    res_pr = dims[i];
+                }
+            }
+            return res_pr;
+        }
+
+        void BuildTree(int tree_id) {
+            PROFILE_SCOPE("ExternalForestBuilder::BuildTree")
+            nodes.clear();
+            nodes.push_back(BuildNode{RootBucket()});
+
+            std::vector<int> level = {0};
+            while (!level.empty()) {
+                std::vector<int> next_level;
+                for (int node_id : level) {
+                    if (nodes[node_id].bucket.count <= leaf_size) {
+                        continue;
+                    }
+                    if (FitsInMemory(nodes[node_id].bucket.count)) {
+                        nodes[node_id].in_memory = true;
+                        continue;
+                    }
+                    if (SplitStreaming(tree_id, node_id)) {
+                        next_level.push_back(nodes[node_id].left);
+                        next_level.push_back(nodes[node_id].right);
+                    }
+                }
+                level.swap(next_level);
+            }
+        }
+
+        bool AddChildren(int node_id, Bucket&& left_bucket, Bucket&& right_bucket) {
+            if (left_bucket.count == 0 || right_bucket.count == 0) {
+                DropBucket(left_bucket);
+                DropBucket(right_bucket);
+                return false;
+            }
+
+            int left_id = nodes.size();
+            nodes.push_back(BuildNode{std::move(left_bucket)});
+            int right_id = nodes.size();
+            nodes.push_back(BuildNode{std::move(right_bucket)});
+
+            nodes[node_id].left = left_id;
+            nodes[node_id].right = right_id;
+            DropBucket(nodes[node_id].bucket);
+            nodes[node_id].bucket = Bucket{};
+            return true;
+        }
+
+        bool SplitStreaming(int tree_id, int node_id) {
+            const Bucket U = nodes[node_id].bucket;
+            auto dims = ProjectionCandidates();
+            std::vector<long double> sums, squares;
+
+            // Проход 1: выборка W (каждая точка с вероятностью 1/2) и суммы для дисперсий
+            bool sample = U.count >= 2 * leaf_size;
+            Bucket W = sample ? Bucket{BucketPath(tree_id, node_id, "w"), 0, 0, true} : U;
+            do {
+                W.count = 0;
+                sums.assign(dims.size(), 0);
+                squares.assign(dims.size(), 0);
+
+                std::ifstream in = OpenBucket(U);
+                std::ofstream out;
+                if (sample) {
+                    out.open(W.path, std::ios_base::binary);
+                }
+                Point<NumericType> point;
+                for (int i = 0; i < U.count; ++i) {
+                    point.ReadPointFrom(in);
+                    if (sample) {
+                        if (mersenne_random() % 2) {
+                            continue;
+                        }
+                        point.WritePointTo(out);
+                    }
+                    W.count++;
+                    for (size_t j = 0; j < dims.size(); ++j) {
+                        long double cor = point.at(dims[j]);
+                        sums[j] += cor;
+                        squares[j] += cor * cor;
+                    }
+                }
+            } while (W.count < leaf_size);
+            int projection = BestProjection(dims, sums, squares, W.count);
+
+            // Проход 2: медиана проекции, при нехватке памяти - по равномерной подвыборке
+            size_t sample_limit = std::max<size_t>(1, options.memory_budget / sizeof(NumericType));
+            std::vector<NumericType> W_projection;
+            W_projection.reserve(std::min<size_t>(sample_limit, W.count));
+            {
+                std::ifstream in = OpenBucket(W);
+                Point<NumericType> point;
+                for (int i = 0; i < W.count; ++i) {
+                    point.ReadPointFrom(in);
+                    if (W_projection.size() < sample_limit) {
+                        W_projection.push_back(point.at(projection));
+                    } else {
+                        size_t pos = mersenne_random() % (i + 1);
+                        if (pos < sample_limit) {
+                            W_projection[pos] = point.at(projection);
+                        }
+                    }
+                }
+            }
+            std::nth_element(W_projection.begin(), W_projection.begin() + W_projection.size() / 2,
+                             W_projection.end());
+            NumericType mid = W_projection[W_projection.size() / 2];
+            W_projection.clear();
+            W_projection.shrink_to_fit();
+
+            // Проход 3: разбиение W на два файла
+            Bucket left_bucket{BucketPath(tree_id, node_id, "l"), 0, 0, true};
+            Bucket right_bucket{BucketPath(tree_id, node_id, "r"), 0, 0, true};
+            {
+                std::ifstream in = OpenBucket(W);
+                std::ofstream left_out(left_bucket.path, std::ios_base::binary);
+                std::ofstream right_out(right_bucket.path, std::ios_base::binary);
+                Point<NumericType> point;
+                for (int i = 0; i < W.count; ++i) {
+                    point.ReadPointFrom(in);
+                    if (point.at(projection) < mid) {
+                        point.WritePointTo(left_out);
+                        left_bucket.count++;
+                    } else {
+                        point.WritePointTo(right_out);
+                        right_bucket.count++;
+                    }
+                }
+            }
+            if (sample) {
+                DropBucket(W);
+            }
+
+            nodes[node_id].projection = projection;
+            nodes[node_id].mid = mid;
+            return AddChildren(node_id, std::move(left_bucket), std::move(right_bucket));
+        }
+
+        void WriteTree(std::ofstream& index) {
+            PROFILE_SCOPE("ExternalForestBuilder::WriteTree")
+            index.write(reinterpret_cast<const char*>(&leaf_size), sizeof(leaf_size));
+            WriteNode(index, 0);
+        }
+
+        // Формат совпадает с RpTreeNode::WriteNodeTo; у внутренних вершин точки не пишутся,
+        // так как поиск возвращает точки только из листьев. mid пишется как NumericType - так его читает ReadNodeFrom
+        void WriteNode(std::ofstream& index, int node_id) {
+            const BuildNode& node = nodes[node_id];
+            if (node.in_memory) {
+                std::vector<Point<NumericType>> points(node.bucket.count);
+                {
+                    std::ifstream in = OpenBucket(node.bucket);
+                    for (auto& point : points) {
+                        point.ReadPointFrom(in);
+                    }
+                }
+                std::vector<int> order(points.size());
+                for (size_t i = 0; i < order.size(); ++i) {
+                    order[i] = i;
+                }
+                WriteInMemory(index, points, order, 0, order.size());
+                return;
+            }
+
+            int node_points_size = node.bucket.count;
+            index.write(reinterpret_cast<const char*>(&node_points_size), sizeof(node_points_size));
+            index.write(reinterpret_cast<const char*>(&node.mid), sizeof(node.mid));
+            index.write(reinterpret_cast<const char*>(&node.projection), sizeof(node.projection));
+            index.write(reinterpret_cast<const char*>(&leaf_size), sizeof(leaf_size));
+            if (node_points_size > 0) {
+                std::ifstream in = OpenBucket(node.bucket);
+                Point<NumericType> point;
+                for (int i = 0; i < node_points_size; ++i) {
+                    point.ReadPointFrom(in);
+                    point.WritePointTo(index);
+                }
+            }
+
+            bool hasChildren = node.left != -1;
+            index.write(reinterpret_cast<const char*>(&hasChildren), sizeof(hasChildren));
+            if (hasChildren) {
+                WriteNode(index, node.left);
+            }
+            index.write(reinterpret_cast<const char*>(&hasChildren), sizeof(hasChildren));
+            if (hasChildren) {
+                WriteNode(index, node.right);
+            }
+        }
+
+        /*!
+         * \brief Поддерево вершины, точки которой уже в памяти: разбиения те же, что у SplitStreaming,
+         * но без файлов. order[begin, end) - номера точек вершины; выборка W и её половины
+         * переставляются в начало этого отрезка, поэтому точки не копируются
+        */
+        void WriteInMemory(std::ofstream& index, const std::vector<Point<NumericType>>& points,
+                           std::vector<int>& order, size_t begin, size_t end) {
+            NumericType mid{0};
+            int projection = 0;
+            size_t split = begin;
+            size_t W_end = end;
+            if (end - begin > static_cast<size_t>(leaf_size)) {
+                if (end - begin >= 2 * static_cast<size_t>(leaf_size)) {
+                    do {
+                        W_end = begin;
+                        for (size_t i = begin; i < end; ++i) {
+                            if (mersenne_random() % 2) {
+                                std::swap(order[W_end++], order[i]);
+                            }
+                        }
+                    } while (W_end - begin < static_cast<size_t>(leaf_size));
+                }
+
+                auto dims = ProjectionCandidates();
+                std::vector<long double> sums(dims.size()), squares(dims.size());
+                for (size_t i = begin; i < W_end; ++i) {
+                    for (size_t j = 0; j < dims.size(); ++j) {
+                        long double cor = points[order[i]].at(dims[j]);
+                        sums[j] += cor;
+                        squares[j] += cor * cor;
+                    }
+                }
+                projection = BestProjection(dims, sums, squares, W_end - begin);
+
+                std::vector<NumericType> W_projection;
+                W_projection.reserve(W_end - begin);
+                for (size_t i = begin; i < W_end; ++i) {
+                    W_projection.push_back(points[order[i]].at(projection));
+                }
+                std::nth_element(W_projection.begin(), W_projection.begin() + W_projection.size() / 2,
+                                 W_projection.end());
+                mid = W_projection[W_projection.size() / 2];
+
+                split = std::partition(order.begin() + begin, order.begin() + W_end, [&](int id) {
+                    return points[id].at(projection) < mid;
+                }) - order.begin();
+            }
+
+            // Как и при разбиении файлов: если одна из половин пуста, вершина остаётся листом со всеми точками
+            bool hasChildren = begin < split && split < W_end;
+            int node_points_size = hasChildren ? 0 : end - begin;
+            index.write(reinterpret_cast<const char*>(&node_points_size), sizeof(node_points_size));
+            index.write(reinterpret_cast<const char*>(&mid), sizeof(mid));
+            index.write(reinterpret_cast<const char*>(&projection), sizeof(projection));
+            index.write(reinterpret_cast<const char*>(&leaf_size), sizeof(leaf_size));
+            for (int i = 0; i < node_points_size; ++i) {
+                points[order[begin + i]].WritePointTo(index);
+            }
+
+            index.write(reinterpret_cast<const char*>(&hasChildren), sizeof(hasChildren));
+            if (hasChildren) {
+                WriteInMemory(index, points, order, begin, split);
+            }
+            index.write(reinterpret_cast<const char*>(&hasChildren), sizeof(hasChildren));
+            if (hasChildren) {
+                WriteInMemory(index, points, order, split, W_end);
+            }
+        }
+
+        // Файлы вершины node_id: её выборка (w) и половины (l, r); удаляются и недописанные после ошибки
+        void ClearTree(int tree_id) {
+            for (int node_id = 0; node_id < static_cast<int>(nodes.size()); ++node_id) {
+                for (const char* suffix : {"l", "r", "w"}) {
+                    std::remove(BucketPath(tree_id, node_id, suffix).c_str());
+                }
+            }
+            nodes.clear();
+        }
+    };
+
+};
+
+#ifndef RPFOREST_RPFORESTEXTERNAL_H
+#define RPFOREST_RPFORESTEXTERNAL_H
+
+#endif //RPFOREST_RPFORESTEXTERNAL_H
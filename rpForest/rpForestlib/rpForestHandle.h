@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "rpForest.h"
+
+namespace NSrpForest {
+
+    /*!
+     * \brief Доступ к лесу, который можно перестраивать во время запросов.
+     * Запросы работают с неизменяемым снимком (shared_ptr), новый лес строится или читается
+     * в фоне и публикуется переключением атомарного индекса между двумя слотами. Читатели не берут
+     * блокировок: отмечаются в счётчике слота и копируют shared_ptr, публикующий ждёт, пока старый
+     * слот покинут. Старый снимок удаляется, когда его отпускает последний читатель.
+     * Фоновые перестройки публикуются в порядке заказа: лес, заказанный раньше уже опубликованного,
+     * отбрасывается. Handle должен жить дольше возвращённых future.
+    */
+    template <typename NumericType>
+    class RpForestHandle {
+    public:
+        using Snapshot = std::shared_ptr<const RpForest<NumericType>>;
+
+        RpForestHandle() = default;
+
+        explicit RpForestHandle(Snapshot forest) {
+            slots[0].forest = std::move(forest);
+        }
+
+        RpForestHandle(const RpForestHandle&) = delete;
+        RpForestHandle& operator=(const RpForestHandle&) = delete;
+
+        Snapshot Acquire() const {
+            int slot = EnterSlot();
+            Snapshot res = slots[slot].forest;
+            readers[slot].fetch_sub(1);
+            return res;
+        }
+
+        std::vector<Point<NumericType>> KnnForPoint(const Point<NumericType>& point_q, int k) const {
+            Snapshot snapshot = Acquire();
+            if (!snapshot) {
+                throw RpForestExperssion("forest is not published yet");
+            }
+            return snapshot->KnnForPoint(point_q, k);
+        }
+
+        void Publish(Snapshot forest) {
+            PublishIfNewer(std::move(forest), ++ordered);
+        }
+
+        /*!
+         * \brief Поколение леса для кэшей: растёт при каждой замене леса и при каждом дочитанном
+         * в фоне дереве (OpenLazy). Старшие 32 бита - номер публикации, младшие - число загруженных деревьев.
+         * Номер хранится в слоте вместе с лесом, поэтому обе части берутся из одного снимка
+        */
+        unsigned long long Generation() const {
+            int slot = EnterSlot();
+            unsigned long long published = slots[slot].number;
+            unsigned long long loaded = slots[slot].forest ? slots[slot].forest->LoadedTrees() : 0;
+            readers[slot].fetch_sub(1);
+            return (published << 32u) | loaded;
+        }
+
+        std::future<void> RebuildAsync(std::set<Point<NumericType>> train, int how_much, int thread_count) {
+            unsigned long long ticket = ++ordered;
+            return std::async(std::launch::async, [this, train = std::move(train), how_much, thread_count, ticket]() {
+                PublishIfNewer(std::make_shared<const RpForest<NumericType>>(train, how_much, thread_count), ticket);
+            });
+        }
+
+        std::future<void> LoadAsync(const std::string& path) {
+            unsigned long long ticket = ++ordered;
+            return std::async(std::launch::async, [this, path, ticket]() {
+                std::ifstream file(path, std::ios_base::binary);
+                if (!file) {
+                    throw RpForestExperssion("cant open forest file " + path);
+                }
+                auto forest = std::make_shared<RpForest<NumericType>>();
+                forest->ReadForestFrom(file);
+                PublishIfNewer(std::move(forest), ticket);
+            });
+        }
+
+        /*!
+         * \brief Публикует лес сразу после чтения первых initial_trees деревьев, остальные дочитываются в фоне
+        */
+        void OpenLazy(const std::string& path, int initial_trees) {
+            auto forest = std::make_shared<RpForest<NumericType>>();
+            forest->OpenForestLazy(path, initial_trees);
+            Publish(std::move(forest));
+        }
+
+    private:
+        struct Published {
+            Snapshot forest;
+            unsigned long long number{0};
+        };
+
+        Published slots[2];
+        std::atomic<int> active{0};
+        mutable std::atomic<int> readers[2]{};
+
+        std::mutex publish_m_;
+        std::atomic<unsigned long long> ordered{0};
+        unsigned long long published_ticket{0};
+        unsigned long long published_count{0};
+
+        // Читатель отмечается в слоте и перепроверяет индекс: если слот успели сменить,
+        // публикующий мог не увидеть отметку и очистить слот, поэтому вход повторяется
+        int EnterSlot() const {
+            while (true) {
+                int slot = active.load();
+                readers[slot].fetch_add(1);
+                if (active.load() == slot) {
+                    return slot;
+                }
+                readers[slot].fetch_sub(1);
+            }
+        }
+
+        void PublishIfNewer(Snapshot forest, unsigned long long ticket) {
+            Snapshot retired; // удаляется после снятия блокировки
+            std::lock_guard<std::mutex> locker(publish_m_);
+            if (ticket < published_ticket) {
+                return;
+            }
+            published_ticket = ticket;
+
+            int old = active.load();
+            slots[1 - old] = Published{std::move(forest), ++published_count};
+            active.store(1 - old);
+            while (readers[old].load() != 0) {
+                std::this_thread::yield();
+            }
+            retired = std::move(slots[old].forest);
+        }
+    };
+
+};
+
+#ifndef RPFOREST_RPFORESTHANDLE_H
+#define RPFOREST_RPFORESTHANDLE_H
+
+#endif //RPFOREST_RPFORESTHANDLE_H
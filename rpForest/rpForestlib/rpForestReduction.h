@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <set>
+#include <type_traits>
+#include <vector>
+
+#include "pointForRpTree.h"
+
+namespace NSrpForest {
+
+    class ReductionExpression {
+    public:
+        ReductionExpression(const std::string& error_m)
+                : message(error_m)
+        {}
+
+        std::string GetError() { return message; }
+
+    private:
+        std::string message{""};
+    };
+
+    enum class ReductionType {
+        None = 0,
+        RandomProjection = 1,
+        Pca = 2
+    };
+
+    struct ReductionOptions {
+        ReductionType type{ReductionType::None};
+        int target_dimension{0};
+        int pca_sample{10000};
+        int pca_iterations{30};
+    };
+
+    /*!
+     * \brief Линейное понижение размерности перед построением леса.
+     * RandomProjection - разреженная матрица Джонсона-Линденштраусса (Achlioptas),
+     * Pca - главные компоненты, найденные итерациями по подпространству на подвыборке.
+     * Для целочисленных NumericType координаты проекции округляются.
+    */
+    template <typename NumericType>
+    class PointProjector {
+    public:
+        PointProjector() = default;
+
+        bool Empty() const { return type == ReductionType::None; }
+
+        int OutputDimension() const { return output_dimension; }
+
+        void Fit(const std::set<Point<NumericType>>& train, const ReductionOptions& options) {
+            type = options.type;
+            matrix.clear();
+            mean.clear();
+            if (Empty()) {
+                return;
+            }
+            if (train.empty()) {
+                throw ReductionExpression("cant fit reduction on empty train");
+            }
+
+            input_dimension = train.begin()->Dimension();
+            output_dimension = options.target_dimension;
+            if (output_dimension <= 0 || output_dimension >= input_dimension) {
+                throw ReductionExpression("target dimension must be in [1, dimension)");
+            }
+
+            std::mt19937_64 mersenne_random(std::random_device{}());
+            mean.assign(input_dimension, 0);
+            if (type == ReductionType::RandomProjection) {
+                double scale = std::sqrt(3.0 / output_dimension);
+                matrix.resize(output_dimension * input_dimension);
+                for (auto& now : matrix) {
+                    auto dice = mersenne_random() % 6;
+                    now = dice == 0 ? scale : (dice == 1 ? -scale : 0);
+                }
+            } else {
+                FitPca(train, options, mersenne_random);
+            }
+        }
+
+        Point<NumericType> Project(const Point<NumericType>& point) const {
+            if (point.Dimension() != static_cast<size_t>(input_dimension)) {
+                throw PointException("diff dimensions");
+            }
+
+            Point<NumericType> res(output_dimension);
+            for (int i = 0; i < output_dimension; ++i) {
+                const double* row = &matrix[i * input_dimension];
+                double cor = 0;
+                for (int j = 0; j < input_dimension; ++j) {
+                    cor += row[j] * (point.at(j) - mean[j]);
+                }
+                if (std::is_integral<NumericType>::value) {
+                    cor = std::round(cor);
+                }
+                res.at(i) = static_cast<NumericType>(cor);
+            }
+            return res;
+        }
+
+        void WriteProjectorTo(std::ofstream& file) const {
+            int type_copy = static_cast<int>(type);
+            file.write(reinterpret_cast<const char*>(&type_copy), sizeof(type_copy));
+            file.write(reinterpret_cast<const char*>(&input_dimension), sizeof(input_dimension));
+            file.write(reinterpret_cast<const char*>(&output_dimension), sizeof(output_dimension));
+            file.write(reinterpret_cast<const char*>(matrix.data()), matrix.size() * sizeof(double));
+            file.write(reinterpret_cast<const char*>(mean.data()), mean.size() * sizeof(double));
+        }
+
+        void ReadProjectorFrom(std::ifstream& file) {
+            int type_copy;
+            file.read(reinterpret_cast<char*>(&type_copy), sizeof(type_copy));
+            type = static_cast<ReductionType>(type_copy);
+            file.read(reinterpret_cast<char*>(&input_dimension), sizeof(input_dimension));
+            file.read(reinterpret_cast<char*>(&output_dimension), sizeof(output_dimension));
+            matrix.resize(output_dimension * input_dimension);
+            mean.resize(input_dimension);
+            file.read(reinterpret_cast<char*>(matrix.data()), matrix.size() * sizeof(double));
+            file.read(reinterpret_cast<char*>(mean.data()), mean.size() * sizeof(double));
+        }
+
+    private:
+        ReductionType type{ReductionType::None};
+        int input_dimension{0};
+        int output_dimension{0};
+        std::vector<double> matrix; // output_dimension строк по input_dimension
+        std::vector<double> mean;
+
+        void FitPca(const std::set<Point<NumericType>>& train, const ReductionOptions& options,
+                    std::mt19937_64& mersenne_random) {
+            size_t sample_size = options.pca_sample > 0 ? options.pca_sample : train.size();
+            std::vector<const Point<NumericType>*> sample;
+            size_t seen = 0;
+            for (const auto& point : train) {
+                if (sample.size() < sample_size) {
+                    sample.push_back(&point);
+                } else {
+                    size_t pos = mersenne_random() % (seen + 1);
+                    if (pos < sample_size) {
+                        sample[pos] = &point;
+                    }
+                }
+                seen++;
+            }
+
+            int d = input_dimension;
+            for (auto point : sample) {
+                for (int j = 0; j < d; ++j) {
+                    mean[j] += point->at(j);
+                }
+            }
+            for (auto& now : mean) {
+                now /= sample.size();
+            }
+
+            std::vector<double> covariance(d * d, 0), centered(d);
+            for (auto point : sample) {
+                for (int j = 0; j < d; ++j) {
+                    centered[j] = point->at(j) - mean[j];
+                }
+                for (int i = 0; i < d; ++i) {
+                    for (int j = i; j < d; ++j) {
+                        covariance[i * d + j] += centered[i] * centered[j];
+                    }
+                }
+            }
+            for (int i = 0; i < d; ++i) {
+                for (int j = 0; j < i; ++j) {
+                    covariance[i * d + j] = covariance[j * d + i];
+                }
+            }
+
+            // Итерации по подпространству: Q <- orth(C * Q), строки matrix - базис Q
+            std::normal_distribution<double> normal;
+            matrix.resize(output_dimension * d);
+            for (auto& now : matrix) {
+                now = normal(mersenne_random);
+            }
+            Orthonormalize(matrix);
+
+            std::vector<double> next(matrix.size());
+            for (int iter = 0; iter < options.pca_iterations; ++iter) {
+                for (int c = 0; c < output_dimension; ++c) {
+                    const double* q = &matrix[c * d];
+                    for (int i = 0; i < d; ++i) {
+                        const double* row = &covariance[i * d];
+                        double sum = 0;
+                        for (int j = 0; j < d; ++j) {
+                            sum += row[j] * q[j];
+                        }
+                        next[c * d + i] = sum;
+                    }
+                }
+                matrix.swap(next);
+                Orthonormalize(matrix);
+            }
+        }
+
+        void Orthonormalize(std::vector<double>& rows) const {
+            int d = input_dimension;
+            for (int c = 0; c < output_dimension; ++c) {
+                double* row = &rows[c * d];
+                for (int prev = 0; prev < c; ++prev) {
+                    const double* other = &rows[prev * d];
+                    double dot = 0;
+                    for (int j = 0; j < d; ++j) {
+                        dot += row[j] * other[j];
+                    }
+                    for (int j = 0; j < d; ++j) {
+                        row[j] -= dot * other[j];
+                    }
+                }
+
+                double norm = 0;
+                for (int j = 0; j < d; ++j) {
+                    norm += row[j] * row[j];
+                }
+                norm = std::sqrt(norm);
+                if (norm == 0) {
+                    row[c % d] = 1;
+                    norm = 1;
+                }
+                for (int j = 0; j < d; ++j) {
+                    row[j] /= norm;
+                }
+            }
+        }
+    };
+
+};
+
+#ifndef RPFOREST_RPFORESTREDUCTION_H
+#define RPFOREST_RPFORESTREDUCTION_H
+
+#endif //RPFOREST_RPFORESTREDUCTION_H
@@ -31,10 +31,18 @@ namespace NSrpForest {
             start = new RpTreeNode(U, min_W_size);
         }
 
-        std::set<Point<NumericType>> FindKnn(const Point<NumericType>& point) {
+        const std::set<Point<NumericType>>& FindKnn(const Point<NumericType>& point) const {
             return start->TreeDownhill(point);
         }
 
+        /*!
+         * \brief Обход всех листьев дерева, func получает множество точек листа
+        */
+        template <typename Func>
+        void ForEachLeaf(Func&& func) const {
+            start->ForEachLeaf(func);
+        }
+
         void WriteTreeTo(std::ofstream& file) const {
             int Ns_copy = Ns;
             file.write(reinterpret_cast<const char*>(&Ns_copy), sizeof(Ns_copy));
@@ -113,7 +113,7 @@ namespace NSrpForest {
             }
         }
 
-        std::set<Point<NumericType>>& TreeDownhill(const Point<NumericType>& point) {
+        const std::set<Point<NumericType>>& TreeDownhill(const Point<NumericType>& point) const {
             if (point.at(projection_for_node) < mid_for_node) {
                 if (left == nullptr) {
                     return node_points;
@@ -127,6 +127,20 @@ namespace NSrpForest {
             return right->TreeDownhill(point);
         }
 
+        template <typename Func>
+        void ForEachLeaf(Func&& func) const {
+            if (left == nullptr && right == nullptr) {
+                func(node_points);
+                return;
+            }
+            if (left != nullptr) {
+                left->ForEachLeaf(func);
+            }
+            if (right != nullptr) {
+                right->ForEachLeaf(func);
+            }
+        }
+
         void WriteNodeTo(std::ofstream& file) const {
             int node_points_size = node_points.size();
             file.write(reinterpret_cast<const char*>(&node_points_size), sizeof(node_points_size));